@@ -2,12 +2,40 @@
 // KTY-BX COMMAND LINE CHESS ENGINE
 /////////////////////////////////////////////////////////////////////////////////////
 #include <iostream>
+#include <cstdio>
+#include <cmath>
 #include <ctime>
 #include <chrono>
-int timer1 = 0;
-int timer2 = 0;
-int timer3 = 0;
-int called = 0;
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <poll.h>
+#include <csignal>
+#include <cstring>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <fstream>
+#include <string>
+#include <sstream>
+#include <vector>
+#include <unordered_map>
+#include <queue>
+#include <algorithm>
+#include <thread>
+#include <mutex>
+#include <shared_mutex>
+#include <condition_variable>
+#include <atomic>
+#include <future>
+#if (defined(__AVX2__) || defined(__SSE2__)) && !defined(NNUE_SCALAR)
+#include <immintrin.h>
+#endif
+#if defined(SEARCH_PROFILE) && (defined(__x86_64__) || defined(__i386__))
+#include <x86intrin.h>
+#endif
 
 /////////////////////////////////////////////////////////////////////////////////////
 // GLOBAL VARIABLES - ENGINE SETTINGS AND INCENTIVES
@@ -16,14 +44,45 @@ int called = 0;
 // settings
 const int MAX_DEPTH = 24;              // set an evaluation depth
 const int MAX_SEARCH_TIME = 5;         // limit the engine's search time (in seconds)
-const int MAX_TREE_WIDTH = 150;        // provide a max branching factor (must be >= 35)
+const int MAX_TREE_WIDTH = 256;        // provide a max branching factor (must be >= 35, underpromotions included)
 const int Q_EXPANSION_FACTOR = 3;      // expand quiescence search up to 3 times deeper
 const int STABILITY_WINDOW = 30;       // q-search must add at least this much value
-const int HASH_TABLE_LENGTH = 1048583; // select prime number close to 1M to reduce hash collisions
+const int HASH_TABLE_LENGTH = 1048583; // select prime number close to 1M to reduce hash collisions (hash=MB picks another size)
+const int MAX_HASH_MB = 16384;         // largest table hash=MB accepts, 2^30 entries
+const int EVAL_CACHE_LENGTH = 262144;  // evaluation cache slots (power of two)
+const int PAWN_HASH_LENGTH = 262144;   // pawn structure hash slots (power of two)
 const int ENDGAME_CUTOFF = 4;          // use endgame settings when there are less pieces
-
-int iteration_depth = MAX_DEPTH;
-
+const char* BOOK_FILE = "book.bin";    // polyglot opening book, ignored if missing
+const bool BOOK_BEST_MOVE = false;     // play the highest weighted book move instead of a weighted random one
+const int BOOK_MAX_PLY = 30;           // only store the first moves of each game in a built book
+const int BOOK_SHARD_LIMIT = 4000000;  // prune single game entries once a builder thread holds this many
+const char* BITBASE_FILE = "bitbases.bin"; // solved endgames made by "full_version bitbases"
+const char* NNUE_FILE = "kitty.nnue";  // optional network weights, replaces the hand written evaluation
+const int BATCH_WINDOW = 4096;         // most batch positions in flight or waiting to be written in order
+const int BATCH_DEPTH = 6;             // default batch search depth
+const int BENCH_DEPTH = 5;             // default bench search depth
+const int MAX_MULTIPV = 16;            // most lines a multipv=N analysis reports
+const char* DAEMON_SOCKET = "kitty.sock"; // default analysis daemon address
+const char* HASH_SNAPSHOT_FILE = "hash.bin"; // transposition table saved and loaded by the daemon
+const char* SPLIT_SOCKET = "kitty-split.sock"; // default distributed search coordinator address
+const int SPLIT_SHARE_DEPTH = 3;       // hash entries at least this deep are passed between distributed workers
+const int DAEMON_CACHE_LIMIT = 1000000;// analyses remembered by the daemon before it starts over
+const int MATCH_NODES = 20000;         // default node budget for each move of a self-play match
+const int MATCH_MAX_PLIES = 400;       // adjudicate a self-play game as a draw after this many plies
+const double SPRT_ELO0 = 0;            // match null hypothesis: no elo gained
+const double SPRT_ELO1 = 5;            // match alternative hypothesis: this many elo gained
+const double SPRT_ALPHA = 0.05;        // chance of accepting a change that gains nothing
+const double SPRT_BETA = 0.05;         // chance of rejecting a change that gains SPRT_ELO1
+const int TUNE_MAX_PASSES = 50;        // stop tuning after this many passes over the parameters
+const int TUNE_Q_DEPTH = 8;            // deepest capture sequence followed to find a quiet tuning position
+
+thread_local int iteration_depth = MAX_DEPTH;
+
+// the evaluation weights (and the PST further down) can be replaced by a header written
+// by "full_version tune", e.g. g++ -DKITTY_PARAMETERS='"tuned_parameters.h"'
+#ifdef KITTY_PARAMETERS
+#include KITTY_PARAMETERS
+#else
 // piece values
 int P_VAL = 100; 
 int N_VAL = 300; 
@@ -33,11 +92,20 @@ int Q_VAL = 900;
 int K_VAL = 10000;
 int VAL[6] = { P_VAL,  N_VAL,  B_VAL,  R_VAL,  Q_VAL,  K_VAL };
 
+int MOBILITY_INCENTIVE = 5;
+
+// pawn structure
+int DOUBLED_PENALTY = 10;
+int ISOLATED_PENALTY = 10;
+int BACKWARD_PENALTY = 8;
+int PASSED_BONUS[8] = { 0, 5, 10, 20, 35, 60, 100, 0 }; // by rank, doubled in the endgame
+#endif
+
 // evaluation bonuses
 int CASTLE_BONUS = 100;
 int DRAW_PENALTY = 100;
+const int BITBASE_WIN = 50000; // won bitbase positions score this minus the plies to mate
 const int PST_WEIGHT = 5;
-const int MOBILITY_INCENTIVE = 5;
 
 // move ordering bonuses
 int MIDDLE_BONUS = 12;
@@ -46,91 +114,571 @@ int EDGE_PENALTY = 8;
 
 // define players
 int player; int computer;
-bool w_resignation; bool is_castled_w;
-bool b_resignation; bool is_castled_b;
+bool w_resignation;
+bool b_resignation;
+
+// summary statistics, reset every iteration.  Building with -DSEARCH_STATS also counts
+// the detailed ones and writes every iteration to STATS_FILE; otherwise they cost nothing
+#ifdef SEARCH_STATS
+#define STATS(statement) statement
+#else
+#define STATS(statement)
+#endif
+const char* STATS_FILE = "search_stats.log";
+const bool STATS_CSV = false;          // write CSV lines instead of JSON lines
+const char* ORDERING_FILE = "move_ordering.log";
+const int ORDERING_INDEX_BUCKETS = 8;  // cutoff indices 0, 1, 2, 3, 4-7, 8-15, 16-31, 32+
+
+// the heuristic_eval term credited with a cutoff move's place in the list
+enum OrderingSource {
+    ORDER_PV, ORDER_PREVIOUS_BEST, ORDER_KILLER,   // the fixed bonuses
+    ORDER_CAPTURE,                                 // mvv-lva outweighs the previous eval
+    ORDER_PREVIOUS_EVAL,                           // the eval from the previous iteration
+    ORDER_POSITIONAL,                              // nothing but the center bonuses
+    ORDERING_SOURCES
+};
+const char* ORDERING_SOURCE_NAMES[ORDERING_SOURCES] = { "pv", "previous_best", "killer", "capture", "previous_eval", "positional" };
+
+struct SearchStats {
+    long minimax_nodes; long quiescence_nodes;
+    long cut_offs; long reductions;
+    long tt_cutoffs;                   // table entries deep enough to replace a search
+    int quiescence_depth;
+    // detailed
+    long leaf_nodes; long bitbase_hits;
+    long tt_probes; long tt_hits;
+    long fail_highs; long first_move_fail_highs;
+#ifdef SEARCH_STATS
+    // move ordering, by remaining depth: how many nodes searched their moves, and for the
+    // ones that failed high, where the cutoff move was in the list and which bonus put it there
+    long ordered_nodes[MAX_DEPTH+1];
+    long cutoff_index_sum[MAX_DEPTH+1];
+    long cutoff_index[MAX_DEPTH+1][ORDERING_INDEX_BUCKETS];
+    long cutoff_source[MAX_DEPTH+1][ORDERING_SOURCES];
+#endif
+};
+thread_local SearchStats search_stats;
+thread_local long total_nodes = 0;
+
+// hot path profiler.  Building with -DSEARCH_PROFILE times the sections below with the
+// cycle counter (the steady clock off x86) and prints a breakdown after every depth_search
+#ifdef SEARCH_PROFILE
+#define PROFILE(section) ProfileTimer profile_timer(section)
+#else
+#define PROFILE(section)
+#endif
+enum ProfileSection {
+    PROFILE_MOVE_GENERATION, PROFILE_MAKE_MOVE, PROFILE_TAKEBACK_MOVE, PROFILE_UPDATE_CHECKS,
+    PROFILE_NODE_EVALUATION, PROFILE_ZOBRIST_KEY, PROFILE_TT_PROBE, PROFILE_TT_STORE,
+    PROFILE_SEARCH,                    // the whole minimax call, what the others are compared with
+    PROFILE_SECTIONS
+};
+const char* PROFILE_SECTION_NAMES[PROFILE_SECTIONS] = {
+    "generate_color_moves_list", "make_move", "takeback_move", "update_checks",
+    "node_evaluation", "gen_zobrist_key", "tt probe", "tt store", "search"
+};
 
-// summary statistics
-int m_nodes = 0; int q_nodes = 0; int total_nodes = 0;
-int cut_offs = 0; int late_move_reductions = 0;
-int hash_entries = 0;
-int max_quiescence_search_depth = 0;
+#ifdef SEARCH_PROFILE
+inline uint64_t profile_clock() {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return std::chrono::steady_clock::now().time_since_epoch().count();
+#endif
+}
+
+thread_local uint64_t profile_cycles[PROFILE_SECTIONS];
+thread_local long profile_calls[PROFILE_SECTIONS];
+
+struct ProfileTimer {
+    int section; uint64_t start;
+    ProfileTimer(int timed_section) : section(timed_section), start(profile_clock()) {}
+    ~ProfileTimer() { profile_cycles[section] += (profile_clock() - start); profile_calls[section]++; }
+};
+#endif
+
+/////////////////////////////////////////////////////////////////////////////////////
+// MOVE ENCODING
+// a move fits in 16 bits: the destination in bits 0-5, the origin in bits 6-11 and a
+// flag in bits 12-15 that tells make_move what kind of move it is.  The capture bit
+// is set for captures, en passant and capturing promotions, and the promotion piece is
+// stored as wN to wQ minus one in the low bits of a promotion flag
+/////////////////////////////////////////////////////////////////////////////////////
+typedef uint16_t Move;
+const int FLAG_QUIET = 0; const int FLAG_DOUBLE_PUSH = 1;
+const int FLAG_SHORT_CASTLE = 2; const int FLAG_LONG_CASTLE = 3;
+const int FLAG_CAPTURE = 4; const int FLAG_EN_PASSANT = 5;
+const int FLAG_PROMOTION = 8; const int FLAG_PROMOTION_CAPTURE = 12;
+
+int encode_move(int origination, int destination, int flag) { return ((flag << 12) | (origination << 6) | destination); }
+int move_origination(int move) { return ((move >> 6) & 63); }
+int move_destination(int move) { return (move & 63); }
+int move_flag(int move) { return (move >> 12); }
+bool move_is_capture(int move) { return (move_flag(move) & FLAG_CAPTURE); }
+bool move_is_promotion(int move) { return (move_flag(move) & FLAG_PROMOTION); }
+int promotion_piece(int move) { return (1 + (move_flag(move) & 3)); } // wN, wB, wR or wQ
 
 /////////////////////////////////////////////////////////////////////////////////////
 // ENGINE CONTAINERS AND STORAGE IDs
 // the engine uses these tables to keep track of the board and move search. The 
-// associated variables are simply to make indexing more intuitive
+// associated variables are simply to make indexing more intuitive.  Board and search
+// state is thread_local so command line tools can give every worker thread its own board
 /////////////////////////////////////////////////////////////////////////////////////
 // continuations
-int game_continuation[120];
-int principal_variation[MAX_DEPTH]; // stored by dist away from root so move can be used in any iteration
-int current_variation[MAX_DEPTH];
+Move game_continuation[120];
+thread_local Move principal_variation[MAX_DEPTH]; // stored by dist away from root so move can be used in any iteration
+thread_local Move current_variation[MAX_DEPTH];
+// triangular table: row ply holds the best line found from that ply on, built as the
+// search returns so the root row is the principal variation once an iteration ends
+thread_local Move pv_table[MAX_DEPTH+1][MAX_DEPTH+1];
+thread_local int pv_length[MAX_DEPTH+1];
 
 // move generation
-int moves_list[2*MAX_DEPTH][MAX_TREE_WIDTH];
-int values_list[2*MAX_DEPTH][MAX_TREE_WIDTH];
-int capture_sequence[2*MAX_DEPTH + 120];
-// MAX_DEPTH spaces alloted for minimax
-// MAX_DEPTH spaces alloted for quiescence
-// 120 spaces alloted for surface game
+thread_local Move moves_list[2*MAX_DEPTH][MAX_TREE_WIDTH];
+thread_local int values_list[2*MAX_DEPTH][MAX_TREE_WIDTH];
 
 // move ordering
-int layer_best_moves[MAX_DEPTH];
-int layer_previous_evals[MAX_DEPTH][4096]; // 64*64 possible move vectors
-int layer_killer_moves[MAX_DEPTH];
+thread_local Move layer_best_moves[MAX_DEPTH];
+thread_local int layer_previous_evals[MAX_DEPTH][4096]; // 64*64 possible move vectors, without the flags
+thread_local Move layer_killer_moves[MAX_DEPTH];
+
+// multipv: root moves already reported this iteration, skipped when looking for the next line
+thread_local Move root_exclusions[MAX_MULTIPV];
+thread_local int root_excluded = 0;
+thread_local int root_eval = 0; // score of the move the last root search returned
+
+// node budget of the current iteration (0 for none).  Once it is spent the search unwinds
+// without storing anything and the iteration is thrown away
+thread_local long iteration_node_limit = 0;
+thread_local bool search_aborted = false;
 
 /////////////////////////////////////////////////////////////////////////////////////
 // CONSTANT BITBOARDS
 // define the chess board
 /////////////////////////////////////////////////////////////////////////////////////
-uint64_t RANK_1 = 0b0000000000000000000000000000000000000000000000000000000011111111;
-uint64_t RANK_2 = 0b0000000000000000000000000000000000000000000000001111111100000000;
-uint64_t RANK_3 = 0b0000000000000000000000000000000000000000111111110000000000000000;
-uint64_t RANK_4 = 0b0000000000000000000000000000000011111111000000000000000000000000;
-uint64_t RANK_5 = 0b0000000000000000000000001111111100000000000000000000000000000000;
-uint64_t RANK_6 = 0b0000000000000000111111110000000000000000000000000000000000000000;
-uint64_t RANK_7 = 0b0000000011111111000000000000000000000000000000000000000000000000;
-uint64_t RANK_8 = 0b1111111100000000000000000000000000000000000000000000000000000000;
+const uint64_t RANK_1 = 0b0000000000000000000000000000000000000000000000000000000011111111;
+const uint64_t RANK_2 = 0b0000000000000000000000000000000000000000000000001111111100000000;
+const uint64_t RANK_3 = 0b0000000000000000000000000000000000000000111111110000000000000000;
+const uint64_t RANK_4 = 0b0000000000000000000000000000000011111111000000000000000000000000;
+const uint64_t RANK_5 = 0b0000000000000000000000001111111100000000000000000000000000000000;
+const uint64_t RANK_6 = 0b0000000000000000111111110000000000000000000000000000000000000000;
+const uint64_t RANK_7 = 0b0000000011111111000000000000000000000000000000000000000000000000;
+const uint64_t RANK_8 = 0b1111111100000000000000000000000000000000000000000000000000000000;
+
+const uint64_t FILE_A = 0b1000000010000000100000001000000010000000100000001000000010000000;
+const uint64_t FILE_B = 0b0100000001000000010000000100000001000000010000000100000001000000;
+const uint64_t FILE_C = 0b0010000000100000001000000010000000100000001000000010000000100000;
+const uint64_t FILE_D = 0b0001000000010000000100000001000000010000000100000001000000010000;
+const uint64_t FILE_E = 0b0000100000001000000010000000100000001000000010000000100000001000;
+const uint64_t FILE_F = 0b0000010000000100000001000000010000000100000001000000010000000100;
+const uint64_t FILE_G = 0b0000001000000010000000100000001000000010000000100000001000000010;
+const uint64_t FILE_H = 0b0000000100000001000000010000000100000001000000010000000100000001;
+
+const uint64_t MIDDLE = 0b0000000000000000000000000001100000011000000000000000000000000000;
+const uint64_t AUXMID = 0b0000000000000000001111000010010000100100001111000000000000000000;
+const uint64_t EDGE   = 0b0000000000000000100000011000000110000001100000010000000000000000;
+
+const uint64_t W_SHORT_CASTLE_ZONE = (3ULL << 1);
+const uint64_t W_LONG_CASTLE_ZONE = (7ULL << 4);
+
+const uint64_t B_SHORT_CASTLE_ZONE = (3ULL << 57);
+const uint64_t B_LONG_CASTLE_ZONE = (7ULL << 60);
+
+// castling rights, in polyglot order.  A move from or to one of the squares below
+// takes away the rights listed for it, as the king or rook has moved or been captured
+const int W_SHORT = 1; const int W_LONG = 2; const int B_SHORT = 4; const int B_LONG = 8;
+const int CASTLING_LOST[64] = {
+    W_SHORT, 0, 0, W_SHORT | W_LONG, 0, 0, 0, W_LONG,
+    0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0,
+    B_SHORT, 0, 0, B_SHORT | B_LONG, 0, 0, 0, B_LONG
+};
+
+/////////////////////////////////////////////////////////////////////////////////////
+// PIECE BITBOARDS
+/////////////////////////////////////////////////////////////////////////////////////
+thread_local uint64_t pos[15]; // piece position look-up table
+// piece IDs
+const int wP=0; const int wN=1; const int wB=2; const int wR=3; const int wQ=4; const int wK=5;
+const int bP=6; const int bN=7; const int bB=8; const int bR=9; const int bQ=10; const int bK=11;
+const int empty=12; const int white=13; const int black=14;
+
+thread_local uint64_t en_passant_w; thread_local uint64_t en_passant_b;
+thread_local int castling_rights = 0;
+thread_local int halfmove_clock = 0; // plies since the last capture or pawn move
+thread_local uint64_t checks[2] = {0, 0};
+
+// zobrist keys, xorshift64* output from a fixed seed computed at compile time, so a
+// position has the same key on every run and in every build.  The keys of all pieces
+// and of the pawns alone are kept up to date by make_move and takeback_move
+const uint32_t ZOBRIST_VERSION = 2; // bump when the keys change, saved hash tables from older keys are refused
+struct ZobristKeys {
+    uint64_t pieces[12][64];
+    uint64_t en_passant[64];
+    uint64_t side;
+    uint64_t castling[16];
+};
 
-uint64_t FILE_A = 0b1000000010000000100000001000000010000000100000001000000010000000;
-uint64_t FILE_B = 0b0100000001000000010000000100000001000000010000000100000001000000;
-uint64_t FILE_C = 0b0010000000100000001000000010000000100000001000000010000000100000;
-uint64_t FILE_D = 0b0001000000010000000100000001000000010000000100000001000000010000;
-uint64_t FILE_E = 0b0000100000001000000010000000100000001000000010000000100000001000;
-uint64_t FILE_F = 0b0000010000000100000001000000010000000100000001000000010000000100;
-uint64_t FILE_G = 0b0000001000000010000000100000001000000010000000100000001000000010;
-uint64_t FILE_H = 0b0000000100000001000000010000000100000001000000010000000100000001;
+constexpr ZobristKeys generate_zobrist_keys() {
+    ZobristKeys keys = {};
+    uint64_t state = 0x5A4F42524953544BULL; // "ZOBRISTK"
+    auto next = [&state]() {
+        state ^= (state >> 12); state ^= (state << 25); state ^= (state >> 27);
+        return (state * 0x2545F4914F6CDD1DULL);
+    };
+    for (int piece=0; piece<12; piece++) {
+        for (int i=0; i<64; i++) { keys.pieces[piece][i] = next(); }
+    }
+    for (int i=0; i<64; i++) { keys.en_passant[i] = next(); }
+    keys.side = next();
+    for (int i=0; i<16; i++) { keys.castling[i] = next(); }
+    return keys;
+}
 
-uint64_t MIDDLE = 0b0000000000000000000000000001100000011000000000000000000000000000;
-uint64_t AUXMID = 0b0000000000000000001111000010010000100100001111000000000000000000;
-uint64_t EDGE   = 0b0000000000000000100000011000000110000001100000010000000000000000;
+constexpr ZobristKeys ZOBRIST_KEYS = generate_zobrist_keys();
+constexpr const uint64_t (&PIECE_TABLE)[12][64] = ZOBRIST_KEYS.pieces;
+thread_local uint64_t piece_key = 0;
+thread_local uint64_t pawn_key = 0;
 
-uint64_t W_SHORT_CASTLE_ZONE = (3ULL << 1);
-uint64_t W_LONG_CASTLE_ZONE = (7ULL << 4);
+void hash_piece(int piece, int index) {
+    piece_key ^= PIECE_TABLE[piece][index];
+    if ((piece == wP) || (piece == bP)) { pawn_key ^= PIECE_TABLE[piece][index]; }
+}
 
-uint64_t B_SHORT_CASTLE_ZONE = (3ULL << 57);
-uint64_t B_LONG_CASTLE_ZONE = (7ULL << 60);
+void init_piece_key() {
+    piece_key = 0; pawn_key = 0;
+    for (int piece=0; piece<12; piece++) {
+        for (int i=0; i<64; i++) {
+            if (pos[piece] & (1ULL << i)) { hash_piece(piece, i); }
+        }
+    }
+}
 
 /////////////////////////////////////////////////////////////////////////////////////
-// PIECE BITBOARDS
+// MATERIAL TABLE
+// the material on the board is summarized by a key which counts every piece type in
+// a mixed radix number.  make_move and takeback_move keep it up to date, and it indexes
+// a precomputed table telling whether the material is a dead draw, the game phase, the
+// king tables to use, how far an advantage should be trusted and which bitbase solves it
 /////////////////////////////////////////////////////////////////////////////////////
-uint64_t pos[15]; // piece position look-up table
-// piece IDs
-int wP=0; int wN=1; int wB=2; int wR=3; int wQ=4; int wK=5;
-int bP=6; int bN=7; int bB=8; int bR=9; int bQ=10; int bK=11;
-int empty=12; int white=13; int black=14;
+struct MaterialEntry {
+    bool draw;           // neither side can ever checkmate
+    bool king_endgame[2];// use the endgame king table for the white / black king
+    uint8_t phase;       // 24 with all pieces on the board, 0 with only kings and pawns
+    uint8_t scale[2];    // out of 64, applied to a white / black advantage
+    uint8_t bitbase;     // 0 for none, otherwise 1 + index into BITBASES
+    uint8_t strong;      // side with the extra material in a bitbase ending
+};
 
-// castling and promotion IDs
-int w_castle_short = 13; int w_castle_long = 14;
-int b_castle_short = 15; int b_castle_long = 16;
-int en_passant_key = 17; int promotion_key = 18;
+// up to 8 pawns, 2 knights, 2 bishops, 2 rooks and 1 queen per side fit in the table
+int MATERIAL_LIMIT[12] = { 8, 2, 2, 2, 1, 1, 8, 2, 2, 2, 1, 1 };
+int MATERIAL_WEIGHT[12] = { 1, 9, 27, 81, 243, 0, 486, 4374, 13122, 39366, 118098, 0 };
+const int MATERIAL_TABLE_LENGTH = 486*486;
+MaterialEntry MATERIAL_TABLE[MATERIAL_TABLE_LENGTH];
+
+thread_local int material_key = 0;
+thread_local int material_overflow = 0; // pieces beyond the table limits (e.g. a second queen)
+thread_local int piece_count[12];
+thread_local MaterialEntry overflow_entry;
+
+void material_add(int piece) {
+    if (piece >= 12) { return; }
+    piece_count[piece]++;
+    material_key += MATERIAL_WEIGHT[piece];
+    if (piece_count[piece] > MATERIAL_LIMIT[piece]) { material_overflow++; }
+}
 
-uint64_t en_passant_w; uint64_t en_passant_b;
-uint64_t checks[2] = {0, 0};
+void material_remove(int piece) {
+    if (piece >= 12) { return; }
+    if (piece_count[piece] > MATERIAL_LIMIT[piece]) { material_overflow--; }
+    piece_count[piece]--;
+    material_key -= MATERIAL_WEIGHT[piece];
+}
 
-void new_game() {
+void init_material() {
+    material_key = 0; material_overflow = 0;
+    for (int piece=0; piece<12; piece++) {
+        piece_count[piece] = 0;
+        for (int n=__builtin_popcountll(pos[piece]); n>0; n--) { material_add(piece); }
+    }
+}
+
+void compute_material_entry(const int counts[12], MaterialEntry& entry) {
+    int minors[2]; int majors[2]; int pieces[2]; int value[2];
+    for (int side=0; side<2; side++) {
+        const int* c = counts + 6*side;
+        minors[side] = (c[1] + c[2]);
+        majors[side] = (c[3] + c[4]);
+        pieces[side] = (minors[side] + majors[side]);
+        value[side] = (c[1]*VAL[1] + c[2]*VAL[2] + c[3]*VAL[3] + c[4]*VAL[4]);
+    }
+
+    // the textbook draws: bare kings with at most one minor piece each
+    entry.draw = ((counts[wP] == 0) && (counts[bP] == 0) && (majors[0] == 0) && (majors[1] == 0)
+                  && (minors[0] <= 1) && (minors[1] <= 1));
+
+    // a king comes out once the other side has few pieces left
+    entry.king_endgame[0] = (pieces[1] <= ENDGAME_CUTOFF);
+    entry.king_endgame[1] = (pieces[0] <= ENDGAME_CUTOFF);
+
+    entry.phase = std::min(24, (minors[0] + minors[1]) + 2*(counts[wR] + counts[bR]) + 4*(counts[wQ] + counts[bQ]));
+
+    // without pawns a small advantage usually can not be converted, unless it is a queen
+    // against lesser pieces (KQ vs KR is a win)
+    for (int side=0; side<2; side++) {
+        const int* c = counts + 6*side;
+        entry.scale[side] = 64;
+        if (c[0] == 0) {
+            if ((c[1] == 2) && (pieces[side] == 2) && (pieces[1-side] == 0) && (counts[6*(1-side)] == 0)) { entry.scale[side] = 2; }
+            else if (((value[side] - value[1-side]) < VAL[3]) && (c[4] == counts[6*(1-side)+4])) { entry.scale[side] = 16; }
+        }
+    }
+
+    // endings solved by a bitbase: one side has a bare king
+    entry.bitbase = 0; entry.strong = 0;
+    for (int side=0; side<2; side++) {
+        const int* c = counts + 6*side;
+        const int* other = counts + 6*(1-side);
+        if ((other[0] + other[1] + other[2] + other[3] + other[4]) != 0) { continue; }
+        int total = (c[0] + c[1] + c[2] + c[3] + c[4]);
+        entry.strong = ((side == 0) ? white : black);
+        if ((total == 1) && (c[4] == 1)) { entry.bitbase = 1; }
+        else if ((total == 1) && (c[3] == 1)) { entry.bitbase = 2; }
+        else if ((total == 1) && (c[0] == 1)) { entry.bitbase = 3; }
+        else if ((total == 2) && (c[1] == 1) && (c[2] == 1)) { entry.bitbase = 4; }
+        if (entry.bitbase) { break; }
+    }
+}
+
+void init_material_table() {
+    int counts[12] = { 0 };
+    for (int key=0; key<MATERIAL_TABLE_LENGTH; key++) {
+        for (int piece=0; piece<12; piece++) {
+            if (MATERIAL_WEIGHT[piece]) { counts[piece] = (key / MATERIAL_WEIGHT[piece]) % (MATERIAL_LIMIT[piece] + 1); }
+        }
+        compute_material_entry(counts, MATERIAL_TABLE[key]);
+    }
+}
+
+const MaterialEntry& material_entry() {
+    if (material_overflow == 0) { return MATERIAL_TABLE[material_key]; }
+    // promoted extra pieces fall outside the table, so work them out directly
+    compute_material_entry(piece_count, overflow_entry);
+    return overflow_entry;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////
+// EFFICIENTLY UPDATABLE NEURAL NETWORK
+// an optional network replaces the hand written evaluation when NNUE_FILE is present.
+// Its inputs are one feature per piece on each square (768 in all), so a move only
+// touches two or three columns of the first layer.  The first layer sums are kept in
+// an accumulator which make_move and takeback_move update as pieces come and go, and a
+// leaf only pays for the small output layer.  Built with -mavx2 (or -march=native) the
+// kernels use 256 bit registers, otherwise SSE2, and NNUE_SCALAR forces plain loops.
+//
+// file layout (little-endian): "KBNN", int32 inputs, int32 hidden size, int16 feature
+// weights [768][256], int16 feature biases [256], int16 output weights [256], int32
+// output bias.  The output is from white's point of view.
+/////////////////////////////////////////////////////////////////////////////////////
+const int NNUE_INPUTS = 768;
+const int NNUE_HIDDEN = 256;
+const int NNUE_QA = 255;   // first layer quantization, also the clipped relu ceiling
+const int NNUE_QB = 64;    // output layer quantization
+const int NNUE_SCALE = 400;// network output to centipawns
+
+alignas(32) int16_t NNUE_FEATURE_WEIGHTS[NNUE_INPUTS][NNUE_HIDDEN];
+alignas(32) int16_t NNUE_FEATURE_BIAS[NNUE_HIDDEN];
+alignas(32) int16_t NNUE_OUTPUT_WEIGHTS[NNUE_HIDDEN];
+int32_t NNUE_OUTPUT_BIAS = 0;
+bool nnue_loaded = false;
+
+alignas(32) thread_local int16_t nnue_accumulator[NNUE_HIDDEN];
+
+void nnue_add_column(const int16_t* column) {
+#if defined(__AVX2__) && !defined(NNUE_SCALAR)
+    for (int i=0; i<NNUE_HIDDEN; i+=16) {
+        __m256i* acc = (__m256i*)(nnue_accumulator + i);
+        _mm256_store_si256(acc, _mm256_add_epi16(_mm256_load_si256(acc), _mm256_load_si256((const __m256i*)(column + i))));
+    }
+#elif defined(__SSE2__) && !defined(NNUE_SCALAR)
+    for (int i=0; i<NNUE_HIDDEN; i+=8) {
+        __m128i* acc = (__m128i*)(nnue_accumulator + i);
+        _mm_store_si128(acc, _mm_add_epi16(_mm_load_si128(acc), _mm_load_si128((const __m128i*)(column + i))));
+    }
+#else
+    for (int i=0; i<NNUE_HIDDEN; i++) { nnue_accumulator[i] += column[i]; }
+#endif
+}
+
+void nnue_sub_column(const int16_t* column) {
+#if defined(__AVX2__) && !defined(NNUE_SCALAR)
+    for (int i=0; i<NNUE_HIDDEN; i+=16) {
+        __m256i* acc = (__m256i*)(nnue_accumulator + i);
+        _mm256_store_si256(acc, _mm256_sub_epi16(_mm256_load_si256(acc), _mm256_load_si256((const __m256i*)(column + i))));
+    }
+#elif defined(__SSE2__) && !defined(NNUE_SCALAR)
+    for (int i=0; i<NNUE_HIDDEN; i+=8) {
+        __m128i* acc = (__m128i*)(nnue_accumulator + i);
+        _mm_store_si128(acc, _mm_sub_epi16(_mm_load_si128(acc), _mm_load_si128((const __m128i*)(column + i))));
+    }
+#else
+    for (int i=0; i<NNUE_HIDDEN; i++) { nnue_accumulator[i] -= column[i]; }
+#endif
+}
+
+void nnue_add_feature(int piece, int index) {
+    if (nnue_loaded) { nnue_add_column(NNUE_FEATURE_WEIGHTS[64*piece + index]); }
+}
+
+void nnue_remove_feature(int piece, int index) {
+    if (nnue_loaded) { nnue_sub_column(NNUE_FEATURE_WEIGHTS[64*piece + index]); }
+}
+
+void nnue_refresh() {
+    // rebuild the accumulator from scratch, needed whenever a whole position is set up
+    if (!nnue_loaded) { return; }
+    for (int i=0; i<NNUE_HIDDEN; i++) { nnue_accumulator[i] = NNUE_FEATURE_BIAS[i]; }
+    for (int piece=0; piece<12; piece++) {
+        for (uint64_t pieces = pos[piece]; pieces; pieces &= (pieces - 1)) {
+            nnue_add_column(NNUE_FEATURE_WEIGHTS[64*piece + __builtin_ctzll(pieces)]);
+        }
+    }
+}
+
+int nnue_evaluation() {
+    // clipped relu of the accumulator dotted with the output weights
+    int32_t sum = 0;
+#if defined(__AVX2__) && !defined(NNUE_SCALAR)
+    const __m256i zero = _mm256_setzero_si256(); const __m256i ceiling = _mm256_set1_epi16(NNUE_QA);
+    __m256i total = _mm256_setzero_si256();
+    for (int i=0; i<NNUE_HIDDEN; i+=16) {
+        __m256i v = _mm256_min_epi16(_mm256_max_epi16(_mm256_load_si256((const __m256i*)(nnue_accumulator + i)), zero), ceiling);
+        total = _mm256_add_epi32(total, _mm256_madd_epi16(v, _mm256_load_si256((const __m256i*)(NNUE_OUTPUT_WEIGHTS + i))));
+    }
+    __m128i half = _mm_add_epi32(_mm256_castsi256_si128(total), _mm256_extracti128_si256(total, 1));
+    half = _mm_add_epi32(half, _mm_shuffle_epi32(half, 0x4E));
+    half = _mm_add_epi32(half, _mm_shuffle_epi32(half, 0xB1));
+    sum = _mm_cvtsi128_si32(half);
+#elif defined(__SSE2__) && !defined(NNUE_SCALAR)
+    const __m128i zero = _mm_setzero_si128(); const __m128i ceiling = _mm_set1_epi16(NNUE_QA);
+    __m128i total = _mm_setzero_si128();
+    for (int i=0; i<NNUE_HIDDEN; i+=8) {
+        __m128i v = _mm_min_epi16(_mm_max_epi16(_mm_load_si128((const __m128i*)(nnue_accumulator + i)), zero), ceiling);
+        total = _mm_add_epi32(total, _mm_madd_epi16(v, _mm_load_si128((const __m128i*)(NNUE_OUTPUT_WEIGHTS + i))));
+    }
+    total = _mm_add_epi32(total, _mm_shuffle_epi32(total, 0x4E));
+    total = _mm_add_epi32(total, _mm_shuffle_epi32(total, 0xB1));
+    sum = _mm_cvtsi128_si32(total);
+#else
+    for (int i=0; i<NNUE_HIDDEN; i++) {
+        int v = std::min(std::max((int)nnue_accumulator[i], 0), NNUE_QA);
+        sum += v * NNUE_OUTPUT_WEIGHTS[i];
+    }
+#endif
+    return (int)(((int64_t)sum + NNUE_OUTPUT_BIAS) * NNUE_SCALE / (NNUE_QA * NNUE_QB));
+}
+
+bool load_nnue(const char* filename) {
+    std::ifstream file(filename, std::ios::binary);
+    if (!file) { return false; }
+    char magic[4]; int32_t inputs = 0; int32_t hidden = 0;
+    file.read(magic, 4);
+    file.read((char*)&inputs, sizeof(inputs));
+    file.read((char*)&hidden, sizeof(hidden));
+    if (!file || std::string(magic, 4) != "KBNN" || inputs != NNUE_INPUTS || hidden != NNUE_HIDDEN) {
+        std::cout << filename << " is not a " << NNUE_INPUTS << "x" << NNUE_HIDDEN << " network, using the standard evaluation" << std::endl;
+        return false;
+    }
+    file.read((char*)NNUE_FEATURE_WEIGHTS, sizeof(NNUE_FEATURE_WEIGHTS));
+    file.read((char*)NNUE_FEATURE_BIAS, sizeof(NNUE_FEATURE_BIAS));
+    file.read((char*)NNUE_OUTPUT_WEIGHTS, sizeof(NNUE_OUTPUT_WEIGHTS));
+    file.read((char*)&NNUE_OUTPUT_BIAS, sizeof(NNUE_OUTPUT_BIAS));
+    if (!file) {
+        std::cout << filename << " is truncated, using the standard evaluation" << std::endl;
+        return false;
+    }
+    nnue_loaded = true;
+    return true;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////
+// STATE STACK
+// make_move pushes whatever a move destroys that cannot be read back from the move
+// itself: the captured piece, castling rights, en passant squares, halfmove clock,
+// keys, material and the network accumulator.  takeback_move moves the pieces back
+// and pops the rest, so every caller unwinds in order without choosing a slot
+/////////////////////////////////////////////////////////////////////////////////////
+struct StateInfo {
+    int captured;   // the piece the move captured, or empty
+    int castling_rights;
+    int halfmove_clock;
+    uint64_t en_passant_w; uint64_t en_passant_b;
+    uint64_t piece_key; uint64_t pawn_key;
+    int material_key; int material_overflow;
+    alignas(32) int16_t accumulator[NNUE_HIDDEN]; // only saved when a network is loaded
+};
+
+// MAX_DEPTH entries for minimax, MAX_DEPTH for quiescence and the rest for the game
+const int STATE_STACK_LENGTH = 2*MAX_DEPTH + MATCH_MAX_PLIES;
+thread_local StateInfo state_stack[STATE_STACK_LENGTH];
+thread_local int state_ply = 0;
+
+void init_state() {
+    // a new position has no history; the rights come from unmoved kings and rooks until
+    // a FEN castling field narrows them down
+    state_ply = 0; halfmove_clock = 0;
     en_passant_w = 0; en_passant_b = 0;
-    bool w_resignation = false; bool is_castled_w = false;
-    bool b_resignation = false; bool is_castled_b = false;
+    castling_rights = 0;
+    if (pos[wK] & (1ULL << 3)) {
+        if (pos[wR] & (1ULL << 0)) { castling_rights |= W_SHORT; }
+        if (pos[wR] & (1ULL << 7)) { castling_rights |= W_LONG; }
+    }
+    if (pos[bK] & (1ULL << 59)) {
+        if (pos[bR] & (1ULL << 56)) { castling_rights |= B_SHORT; }
+        if (pos[bR] & (1ULL << 63)) { castling_rights |= B_LONG; }
+    }
+}
+
+int parse_castling_field(const std::string& field) {
+    // the rights of a FEN castling field (e.g. "KQk" or "-"), -1 when it is not one
+    int rights = 0;
+    for (char c : field) {
+        if (c == 'K') { rights |= W_SHORT; }
+        else if (c == 'Q') { rights |= W_LONG; }
+        else if (c == 'k') { rights |= B_SHORT; }
+        else if (c == 'q') { rights |= B_LONG; }
+        else if (c != '-') { return -1; }
+    }
+    return rights;
+}
+
+void push_state(int captured) {
+    StateInfo& state = state_stack[state_ply++];
+    state.captured = captured;
+    state.castling_rights = castling_rights; state.halfmove_clock = halfmove_clock;
+    state.en_passant_w = en_passant_w; state.en_passant_b = en_passant_b;
+    state.piece_key = piece_key; state.pawn_key = pawn_key;
+    state.material_key = material_key; state.material_overflow = material_overflow;
+    if (nnue_loaded) { memcpy(state.accumulator, nnue_accumulator, sizeof(nnue_accumulator)); }
+}
+
+const StateInfo& pop_state() {
+    const StateInfo& state = state_stack[--state_ply];
+    castling_rights = state.castling_rights; halfmove_clock = state.halfmove_clock;
+    en_passant_w = state.en_passant_w; en_passant_b = state.en_passant_b;
+    piece_key = state.piece_key; pawn_key = state.pawn_key;
+    material_key = state.material_key; material_overflow = state.material_overflow;
+    if (nnue_loaded) { memcpy(nnue_accumulator, state.accumulator, sizeof(nnue_accumulator)); }
+    return state;
+}
+
+void new_game() {
+    w_resignation = false;
+    b_resignation = false;
     pos[wP] = 0b0000000000000000000000000000000000000000000000001111111100000000;
     pos[wN] = 0b0000000000000000000000000000000000000000000000000000000001000010;
     pos[wB] = 0b0000000000000000000000000000000000000000000000000000000000100100;
@@ -148,6 +696,7 @@ void new_game() {
     pos[empty] = 0b0000000000000000111111111111111111111111111111110000000000000000;
     pos[white] = 0b0000000000000000000000000000000000000000000000001111111111111111;
     pos[black] = 0b1111111111111111000000000000000000000000000000000000000000000000;
+    init_material(); init_piece_key(); nnue_refresh(); init_state();
 }
 
 void update_colors() {
@@ -189,6 +738,7 @@ void read_FEN(std::string fen) {
         i++;
     }
     update_colors();
+    init_material(); init_piece_key(); nnue_refresh(); init_state();
 }
 
 /////////////////////////////////////////////////////////////////////////////////////
@@ -196,46 +746,29 @@ void read_FEN(std::string fen) {
 /////////////////////////////////////////////////////////////////////////////////////
 int bit_scan_left(uint64_t bits) {
     // return position of first non-zero bit scanning right to left
-    int i = 0;
-    while ((((1ULL << i) & bits) == 0) && (i < 64)) { i++; }
-    return i;
+    if (bits == 0) { return 64; }
+    return __builtin_ctzll(bits);
 }
 
 int bit_scan_right(uint64_t bits) {
     // return position of first non-zero bit scanning left to right
-    int i = 63;
-    while ((((1ULL << i) & bits) == 0) && (i>=0)) { i--; }
-    return i;
+    if (bits == 0) { return -1; }
+    return (63 - __builtin_clzll(bits));
 }
 
 int count(uint64_t bits) {
     // count number of non-zero bits
-    int count = 0;
-    while (bits) {
-        count += (bits & 1ULL);
-        bits = bits >> 1;
-    }
-    return count;
+    return __builtin_popcountll(bits);
 }
 
-int opp(int color) {
+constexpr int opp(int color) {
     // change sides
-    if (color == white) { return black; }
-    else { return white; }
-}
-
-uint64_t uint64_t_rand() {
-    // generate random 64 bit number, used to initialize hashes
-    uint64_t num = 0;
-    for (int i=0; i<64; i++) { 
-        num = (num*2 + rand()%2);
-    }
-    return num;
+    return ((color == white) ? black : white);
 }
 
 void print_coords(int move) {
-    int origination = (move >> 6);
-    int destination = (move & 63);
+    int origination = move_origination(move);
+    int destination = move_destination(move);
     std::cout << char('H' - origination%8);
     std::cout << char('1' + origination/8);
     std::cout << ":";
@@ -255,6 +788,7 @@ int material_value_at(int index) {
 // PIECE SQUARE TABLES
 // give each square a positional weight depending on the piece.
 /////////////////////////////////////////////////////////////////////////////////////
+#ifndef KITTY_PARAMETERS
 int PST[7][64] = {
     // pawn table
     {  0,  0,  0,  0,  0,  0,  0,  0,
@@ -320,6 +854,7 @@ int PST[7][64] = {
       -6, -6,  0,  0,  0,  0, -6, -6,
      -10, -6, -6, -6, -6, -6, -6,-10 }
 };
+#endif
 
 int black_pst_index(int white_index) {
     // reflection across the center line
@@ -339,11 +874,19 @@ void scale_PST() {
 // this array stores the "rays" pointing away from every square to help with
 // generating moves for sliding pieces
 /////////////////////////////////////////////////////////////////////////////////////
-uint64_t RAYS[64][8]; // sliding moves array
-int nrt=0; int sth=1; int est=2; int wst=3;
-int nrtest=4; int nrtwst=5; int sthest=6; int sthwst=7;
+const int nrt=0; const int sth=1; const int est=2; const int wst=3;
+const int nrtest=4; const int nrtwst=5; const int sthest=6; const int sthwst=7;
+
+// the rays and the knight, king and pawn attacks from every square are all computed by
+// the compiler, so the program starts without building any tables
+struct AttackTables {
+    uint64_t rays[64][8];
+    uint64_t knight[64];
+    uint64_t king[64];      // without castling
+    uint64_t pawn[2][64];   // white, black
+};
 
-void add_ray(int index, uint64_t boundary, int vector, int mem_index) {
+constexpr uint64_t ray_from(int index, uint64_t boundary, int vector) {
     // constant bitboards are used to bound rays within the board
     uint64_t square = (1ULL << index); uint64_t ray = 0;
 
@@ -355,80 +898,505 @@ void add_ray(int index, uint64_t boundary, int vector, int mem_index) {
             if (ray & boundary) { break; }
         }
     }
-    RAYS[index][mem_index] = ray;
+    return ray;
+}
+
+constexpr uint64_t knight_attacks_from(int i) {
+    // knights jump with a 2x3 pattern once in any direction if they stay in bounds
+    uint64_t bits = (1ULL << i);
+    if (bits & FILE_A) { return ((bits << 15) | (bits << 6) | (bits >> 10) | (bits >> 17)); }
+    else if (bits & FILE_B) { return ((bits << 17) | (bits << 15) | (bits << 6) | (bits >> 10) | (bits >> 15) | (bits >> 17)); }
+    else if (bits & FILE_G) { return ((bits << 17) | (bits << 15) | (bits << 10) | (bits >> 6) | (bits >> 15) | (bits >> 17)); }
+    else if (bits & FILE_H) { return ((bits << 17) | (bits << 10) | (bits >> 6) | (bits >> 15)); }
+    else { return ((bits << 17) | (bits << 15) | (bits << 10) | (bits << 6) | (bits >> 6) | (bits >> 10) | (bits >> 15) | (bits >> 17)); }
+}
+
+constexpr uint64_t king_attacks_from(int i) {
+    // king moves one square in any direction if it stays in bounds
+    uint64_t bits = (1ULL << i);
+    uint64_t moves = ((bits << 9) | (bits << 8) | (bits << 7) | (bits << 1) | (bits >> 1) | (bits >> 7) | (bits >> 8) | (bits >> 9));
+    if (bits & FILE_A) { moves ^= ((bits << 9) | (bits << 1) | (bits >> 7)); }
+    else if (bits & FILE_H) { moves ^= ((bits << 7) | (bits >> 1) | (bits >> 9)); }
+    return moves;
+}
+
+constexpr uint64_t pawn_attacks_from(int i, bool white_pawn) {
+    // pawns attack diagonally forward
+    uint64_t bits = (1ULL << i);
+    if (white_pawn) {
+        if (bits & FILE_A) { return (bits << 7); }
+        else if (bits & FILE_H) { return (bits << 9); }
+        else { return ((bits << 9) | (bits << 7)); }
+    }
+    if (bits & FILE_A) { return (bits >> 9); }
+    else if (bits & FILE_H) { return (bits >> 7); }
+    else { return ((bits >> 7) | (bits >> 9)); }
 }
 
-void fill_RAYS() {
+constexpr AttackTables generate_attack_tables() {
+    AttackTables tables = {};
     for (int i=0; i<64; i++) {
         // cardinal rays
-        add_ray(i, RANK_8,  8, nrt); // north
-        add_ray(i, RANK_1, -8, sth); // south
-        add_ray(i, FILE_H, -1, est); // east
-        add_ray(i, FILE_A,  1, wst); // west
+        tables.rays[i][nrt] = ray_from(i, RANK_8,  8); // north
+        tables.rays[i][sth] = ray_from(i, RANK_1, -8); // south
+        tables.rays[i][est] = ray_from(i, FILE_H, -1); // east
+        tables.rays[i][wst] = ray_from(i, FILE_A,  1); // west
 
         // boundary is composite for secondary rays
-        add_ray(i, (FILE_H | RANK_8),  7, nrtest); // north east
-        add_ray(i, (FILE_A | RANK_8),  9, nrtwst); // north west
-        add_ray(i, (FILE_H | RANK_1), -9, sthest); // south east
-        add_ray(i, (FILE_A | RANK_1), -7, sthwst); // south west
+        tables.rays[i][nrtest] = ray_from(i, (FILE_H | RANK_8),  7); // north east
+        tables.rays[i][nrtwst] = ray_from(i, (FILE_A | RANK_8),  9); // north west
+        tables.rays[i][sthest] = ray_from(i, (FILE_H | RANK_1), -9); // south east
+        tables.rays[i][sthwst] = ray_from(i, (FILE_A | RANK_1), -7); // south west
+
+        tables.knight[i] = knight_attacks_from(i);
+        tables.king[i] = king_attacks_from(i);
+        tables.pawn[0][i] = pawn_attacks_from(i, true);
+        tables.pawn[1][i] = pawn_attacks_from(i, false);
     }
+    return tables;
 }
 
+constexpr AttackTables ATTACK_TABLES = generate_attack_tables();
+constexpr const uint64_t (&RAYS)[64][8] = ATTACK_TABLES.rays; // sliding moves array
+
 /////////////////////////////////////////////////////////////////////////////////////
 // TRANSPOSITION TABLE AND ZOBRIST KEYS
 // using a 64 bit random number assigned to every piece and every square, a 
 // psuedo-unique zobrist key can be generated for any position.  This key can then be
 // used to store information about positions in a hash table
 /////////////////////////////////////////////////////////////////////////////////////
-uint64_t HASH_TABLE[HASH_TABLE_LENGTH][4];
-int p_key=0; int p_eval=1; int p_depth=2; int p_best=3;
+// the eval is stored by the parent from its own point of view, and a search cut short by
+// the window only bounds it: HASH_LOWER means the true score is at least eval (the
+// parent's move failed high), HASH_UPPER at most eval (every reply refuted it)
+enum HashBound : uint8_t { HASH_EXACT, HASH_LOWER, HASH_UPPER };
+
+struct HashEntry {
+    uint64_t key;
+    int32_t eval;
+    int8_t depth;
+    uint8_t bound;
+    Move best;
+};
 
-// zobrist key initialization tables
-uint64_t PIECE_TABLE[12][64];
-uint64_t EN_PASSANT_TABLE[64];
-uint64_t SIDE;
+// the table itself holds the entry's data packed into one word and the key xored with
+// it.  Threads share the table without locks, and a slot two of them wrote at once no
+// longer decodes to its key, so a torn entry is a miss instead of a wrong score
+struct HashSlot {
+    std::atomic<uint64_t> check; // key ^ data
+    std::atomic<uint64_t> data;
+};
 
-void seed_tables() {
-    SIDE = uint64_t_rand();
-    for (int i=0; i<64; i++) {
-        EN_PASSANT_TABLE[i] = uint64_t_rand();
-        for (int piece=0; piece<12; piece++) {
-            PIECE_TABLE[piece][i] = uint64_t_rand();
-        }
-    }
+HashSlot* allocate_hash_table(int length) {
+    // allocated on a 2 MB boundary and marked for transparent huge pages, so a probe
+    // costs one TLB entry per 2 MB instead of per 4 KB.  Without huge pages (or the
+    // alignment) it is an ordinary allocation; either way it is released with free()
+    const size_t huge_page = (2 << 20);
+    size_t bytes = (((sizeof(HashSlot) * length) + huge_page - 1) / huge_page) * huge_page;
+    void* table = nullptr;
+    if (posix_memalign(&table, huge_page, bytes) != 0) { return (HashSlot*)calloc(length, sizeof(HashSlot)); }
+#ifdef MADV_HUGEPAGE
+    madvise(table, bytes, MADV_HUGEPAGE);
+#endif
+    memset(table, 0, bytes);
+    return (HashSlot*)table;
+}
+
+// the length is only known at run time, so key % length is done with a precomputed
+// reciprocal instead of a division on every probe (Lemire's fastmod, exact for 64 bits)
+int hash_table_length = HASH_TABLE_LENGTH;
+unsigned __int128 hash_table_reciprocal = (~(unsigned __int128)0 / HASH_TABLE_LENGTH) + 1;
+HashSlot* HASH_TABLE = allocate_hash_table(HASH_TABLE_LENGTH); // 16 bytes an entry
+
+bool resize_hash_table(int megabytes) {
+    // only before any search starts.  The length is kept prime like the default one,
+    // the largest prime number of entries that fits in the given size
+    if ((megabytes < 1) || (megabytes > MAX_HASH_MB)) { return false; }
+    int length = (int)(((size_t)megabytes << 20) / sizeof(HashSlot));
+    auto is_prime = [](int n) {
+        for (int d=2; (long)d*d <= n; d++) { if (n % d == 0) { return false; } }
+        return (n > 1);
+    };
+    while (!is_prime(length)) { length--; }
+    HashSlot* table = allocate_hash_table(length);
+    if (table == nullptr) { return false; }
+    free(HASH_TABLE);
+    HASH_TABLE = table;
+    hash_table_length = length;
+    hash_table_reciprocal = (~(unsigned __int128)0 / length) + 1;
+    return true;
+}
+
+HashEntry read_hash_slot(int hash) {
+    // whatever the slot holds, the key of a torn slot matches no position
+    uint64_t data = HASH_TABLE[hash].data.load(std::memory_order_relaxed);
+    uint64_t check = HASH_TABLE[hash].check.load(std::memory_order_relaxed);
+    return { check ^ data, (int32_t)(uint32_t)data, (int8_t)(uint8_t)(data >> 32), (uint8_t)(data >> 40), (Move)(data >> 48) };
+}
+
+#ifdef SEARCH_STATS
+thread_local bool hash_table_hidden = false; // every probe misses, as with a cleared table
+#endif
+
+bool read_hash_entry(int hash, uint64_t key, HashEntry& entry) {
+    entry = read_hash_slot(hash);
+    STATS(if (hash_table_hidden) { return false; })
+    return (entry.key == key);
+}
+
+void write_hash_entry(int hash, const HashEntry& entry) {
+    uint64_t data = ((uint64_t)(uint32_t)entry.eval | ((uint64_t)(uint8_t)entry.depth << 32) | ((uint64_t)entry.bound << 40)
+                     | ((uint64_t)entry.best << 48));
+    HASH_TABLE[hash].check.store(entry.key ^ data, std::memory_order_relaxed);
+    HASH_TABLE[hash].data.store(data, std::memory_order_relaxed);
 }
 
+bool replaces_hash_entry(const HashEntry& stored, const HashEntry& entry) {
+    // a shallower result never replaces a deeper score, only a deeper bound (which an
+    // earlier window left behind, and which a new window may have no use for)
+    return ((stored.depth <= entry.depth) || ((stored.bound != HASH_EXACT) && (entry.bound == HASH_EXACT)));
+}
+
+void store_hash_move(int hash, uint64_t key, Move best) {
+    // the best move of a position, its score is stored by the parent afterwards.  A new
+    // position starts too shallow for any probe to take its score
+    HashEntry entry;
+    if (!read_hash_entry(hash, key, entry)) { entry = { key, 0, -1, HASH_EXACT, 0 }; }
+    entry.best = best;
+    write_hash_entry(hash, entry);
+}
+
+// the rest of the zobrist keys (all of them are generated with PIECE_TABLE)
+constexpr const uint64_t (&EN_PASSANT_TABLE)[64] = ZOBRIST_KEYS.en_passant;
+constexpr uint64_t SIDE = ZOBRIST_KEYS.side;
+constexpr const uint64_t (&CASTLING_TABLE)[16] = ZOBRIST_KEYS.castling;
+
+// polyglot key initialization table
+// the published polyglot Random64 table: 768 piece-square keys, 4 castling keys, 8 en
+// passant file keys and 1 side to move key, so books made by other programs match
+const uint64_t POLYGLOT_RANDOM[781] = {
+    0x9D39247E33776D41, 0x2AF7398005AAA5C7, 0x44DB015024623547, 0x9C15F73E62A76AE2,
+    0x75834465489C0C89, 0x3290AC3A203001BF, 0x0FBBAD1F61042279, 0xE83A908FF2FB60CA,
+    0x0D7E765D58755C10, 0x1A083822CEAFE02D, 0x9605D5F0E25EC3B0, 0xD021FF5CD13A2ED5,
+    0x40BDF15D4A672E32, 0x011355146FD56395, 0x5DB4832046F3D9E5, 0x239F8B2D7FF719CC,
+    0x05D1A1AE85B49AA1, 0x679F848F6E8FC971, 0x7449BBFF801FED0B, 0x7D11CDB1C3B7ADF0,
+    0x82C7709E781EB7CC, 0xF3218F1C9510786C, 0x331478F3AF51BBE6, 0x4BB38DE5E7219443,
+    0xAA649C6EBCFD50FC, 0x8DBD98A352AFD40B, 0x87D2074B81D79217, 0x19F3C751D3E92AE1,
+    0xB4AB30F062B19ABF, 0x7B0500AC42047AC4, 0xC9452CA81A09D85D, 0x24AA6C514DA27500,
+    0x4C9F34427501B447, 0x14A68FD73C910841, 0xA71B9B83461CBD93, 0x03488B95B0F1850F,
+    0x637B2B34FF93C040, 0x09D1BC9A3DD90A94, 0x3575668334A1DD3B, 0x735E2B97A4C45A23,
+    0x18727070F1BD400B, 0x1FCBACD259BF02E7, 0xD310A7C2CE9B6555, 0xBF983FE0FE5D8244,
+    0x9F74D14F7454A824, 0x51EBDC4AB9BA3035, 0x5C82C505DB9AB0FA, 0xFCF7FE8A3430B241,
+    0x3253A729B9BA3DDE, 0x8C74C368081B3075, 0xB9BC6C87167C33E7, 0x7EF48F2B83024E20,
+    0x11D505D4C351BD7F, 0x6568FCA92C76A243, 0x4DE0B0F40F32A7B8, 0x96D693460CC37E5D,
+    0x42E240CB63689F2F, 0x6D2BDCDAE2919661, 0x42880B0236E4D951, 0x5F0F4A5898171BB6,
+    0x39F890F579F92F88, 0x93C5B5F47356388B, 0x63DC359D8D231B78, 0xEC16CA8AEA98AD76,
+    0x5355F900C2A82DC7, 0x07FB9F855A997142, 0x5093417AA8A7ED5E, 0x7BCBC38DA25A7F3C,
+    0x19FC8A768CF4B6D4, 0x637A7780DECFC0D9, 0x8249A47AEE0E41F7, 0x79AD695501E7D1E8,
+    0x14ACBAF4777D5776, 0xF145B6BECCDEA195, 0xDABF2AC8201752FC, 0x24C3C94DF9C8D3F6,
+    0xBB6E2924F03912EA, 0x0CE26C0B95C980D9, 0xA49CD132BFBF7CC4, 0xE99D662AF4243939,
+    0x27E6AD7891165C3F, 0x8535F040B9744FF1, 0x54B3F4FA5F40D873, 0x72B12C32127FED2B,
+    0xEE954D3C7B411F47, 0x9A85AC909A24EAA1, 0x70AC4CD9F04F21F5, 0xF9B89D3E99A075C2,
+    0x87B3E2B2B5C907B1, 0xA366E5B8C54F48B8, 0xAE4A9346CC3F7CF2, 0x1920C04D47267BBD,
+    0x87BF02C6B49E2AE9, 0x092237AC237F3859, 0xFF07F64EF8ED14D0, 0x8DE8DCA9F03CC54E,
+    0x9C1633264DB49C89, 0xB3F22C3D0B0B38ED, 0x390E5FB44D01144B, 0x5BFEA5B4712768E9,
+    0x1E1032911FA78984, 0x9A74ACB964E78CB3, 0x4F80F7A035DAFB04, 0x6304D09A0B3738C4,
+    0x2171E64683023A08, 0x5B9B63EB9CEFF80C, 0x506AACF489889342, 0x1881AFC9A3A701D6,
+    0x6503080440750644, 0xDFD395339CDBF4A7, 0xEF927DBCF00C20F2, 0x7B32F7D1E03680EC,
+    0xB9FD7620E7316243, 0x05A7E8A57DB91B77, 0xB5889C6E15630A75, 0x4A750A09CE9573F7,
+    0xCF464CEC899A2F8A, 0xF538639CE705B824, 0x3C79A0FF5580EF7F, 0xEDE6C87F8477609D,
+    0x799E81F05BC93F31, 0x86536B8CF3428A8C, 0x97D7374C60087B73, 0xA246637CFF328532,
+    0x043FCAE60CC0EBA0, 0x920E449535DD359E, 0x70EB093B15B290CC, 0x73A1921916591CBD,
+    0x56436C9FE1A1AA8D, 0xEFAC4B70633B8F81, 0xBB215798D45DF7AF, 0x45F20042F24F1768,
+    0x930F80F4E8EB7462, 0xFF6712FFCFD75EA1, 0xAE623FD67468AA70, 0xDD2C5BC84BC8D8FC,
+    0x7EED120D54CF2DD9, 0x22FE545401165F1C, 0xC91800E98FB99929, 0x808BD68E6AC10365,
+    0xDEC468145B7605F6, 0x1BEDE3A3AEF53302, 0x43539603D6C55602, 0xAA969B5C691CCB7A,
+    0xA87832D392EFEE56, 0x65942C7B3C7E11AE, 0xDED2D633CAD004F6, 0x21F08570F420E565,
+    0xB415938D7DA94E3C, 0x91B859E59ECB6350, 0x10CFF333E0ED804A, 0x28AED140BE0BB7DD,
+    0xC5CC1D89724FA456, 0x5648F680F11A2741, 0x2D255069F0B7DAB3, 0x9BC5A38EF729ABD4,
+    0xEF2F054308F6A2BC, 0xAF2042F5CC5C2858, 0x480412BAB7F5BE2A, 0xAEF3AF4A563DFE43,
+    0x19AFE59AE451497F, 0x52593803DFF1E840, 0xF4F076E65F2CE6F0, 0x11379625747D5AF3,
+    0xBCE5D2248682C115, 0x9DA4243DE836994F, 0x066F70B33FE09017, 0x4DC4DE189B671A1C,
+    0x51039AB7712457C3, 0xC07A3F80C31FB4B4, 0xB46EE9C5E64A6E7C, 0xB3819A42ABE61C87,
+    0x21A007933A522A20, 0x2DF16F761598AA4F, 0x763C4A1371B368FD, 0xF793C46702E086A0,
+    0xD7288E012AEB8D31, 0xDE336A2A4BC1C44B, 0x0BF692B38D079F23, 0x2C604A7A177326B3,
+    0x4850E73E03EB6064, 0xCFC447F1E53C8E1B, 0xB05CA3F564268D99, 0x9AE182C8BC9474E8,
+    0xA4FC4BD4FC5558CA, 0xE755178D58FC4E76, 0x69B97DB1A4C03DFE, 0xF9B5B7C4ACC67C96,
+    0xFC6A82D64B8655FB, 0x9C684CB6C4D24417, 0x8EC97D2917456ED0, 0x6703DF9D2924E97E,
+    0xC547F57E42A7444E, 0x78E37644E7CAD29E, 0xFE9A44E9362F05FA, 0x08BD35CC38336615,
+    0x9315E5EB3A129ACE, 0x94061B871E04DF75, 0xDF1D9F9D784BA010, 0x3BBA57B68871B59D,
+    0xD2B7ADEEDED1F73F, 0xF7A255D83BC373F8, 0xD7F4F2448C0CEB81, 0xD95BE88CD210FFA7,
+    0x336F52F8FF4728E7, 0xA74049DAC312AC71, 0xA2F61BB6E437FDB5, 0x4F2A5CB07F6A35B3,
+    0x87D380BDA5BF7859, 0x16B9F7E06C453A21, 0x7BA2484C8A0FD54E, 0xF3A678CAD9A2E38C,
+    0x39B0BF7DDE437BA2, 0xFCAF55C1BF8A4424, 0x18FCF680573FA594, 0x4C0563B89F495AC3,
+    0x40E087931A00930D, 0x8CFFA9412EB642C1, 0x68CA39053261169F, 0x7A1EE967D27579E2,
+    0x9D1D60E5076F5B6F, 0x3810E399B6F65BA2, 0x32095B6D4AB5F9B1, 0x35CAB62109DD038A,
+    0xA90B24499FCFAFB1, 0x77A225A07CC2C6BD, 0x513E5E634C70E331, 0x4361C0CA3F692F12,
+    0xD941ACA44B20A45B, 0x528F7C8602C5807B, 0x52AB92BEB9613989, 0x9D1DFA2EFC557F73,
+    0x722FF175F572C348, 0x1D1260A51107FE97, 0x7A249A57EC0C9BA2, 0x04208FE9E8F7F2D6,
+    0x5A110C6058B920A0, 0x0CD9A497658A5698, 0x56FD23C8F9715A4C, 0x284C847B9D887AAE,
+    0x04FEABFBBDB619CB, 0x742E1E651C60BA83, 0x9A9632E65904AD3C, 0x881B82A13B51B9E2,
+    0x506E6744CD974924, 0xB0183DB56FFC6A79, 0x0ED9B915C66ED37E, 0x5E11E86D5873D484,
+    0xF678647E3519AC6E, 0x1B85D488D0F20CC5, 0xDAB9FE6525D89021, 0x0D151D86ADB73615,
+    0xA865A54EDCC0F019, 0x93C42566AEF98FFB, 0x99E7AFEABE000731, 0x48CBFF086DDF285A,
+    0x7F9B6AF1EBF78BAF, 0x58627E1A149BBA21, 0x2CD16E2ABD791E33, 0xD363EFF5F0977996,
+    0x0CE2A38C344A6EED, 0x1A804AADB9CFA741, 0x907F30421D78C5DE, 0x501F65EDB3034D07,
+    0x37624AE5A48FA6E9, 0x957BAF61700CFF4E, 0x3A6C27934E31188A, 0xD49503536ABCA345,
+    0x088E049589C432E0, 0xF943AEE7FEBF21B8, 0x6C3B8E3E336139D3, 0x364F6FFA464EE52E,
+    0xD60F6DCEDC314222, 0x56963B0DCA418FC0, 0x16F50EDF91E513AF, 0xEF1955914B609F93,
+    0x565601C0364E3228, 0xECB53939887E8175, 0xBAC7A9A18531294B, 0xB344C470397BBA52,
+    0x65D34954DAF3CEBD, 0xB4B81B3FA97511E2, 0xB422061193D6F6A7, 0x071582401C38434D,
+    0x7A13F18BBEDC4FF5, 0xBC4097B116C524D2, 0x59B97885E2F2EA28, 0x99170A5DC3115544,
+    0x6F423357E7C6A9F9, 0x325928EE6E6F8794, 0xD0E4366228B03343, 0x565C31F7DE89EA27,
+    0x30F5611484119414, 0xD873DB391292ED4F, 0x7BD94E1D8E17DEBC, 0xC7D9F16864A76E94,
+    0x947AE053EE56E63C, 0xC8C93882F9475F5F, 0x3A9BF55BA91F81CA, 0xD9A11FBB3D9808E4,
+    0x0FD22063EDC29FCA, 0xB3F256D8ACA0B0B9, 0xB03031A8B4516E84, 0x35DD37D5871448AF,
+    0xE9F6082B05542E4E, 0xEBFAFA33D7254B59, 0x9255ABB50D532280, 0xB9AB4CE57F2D34F3,
+    0x693501D628297551, 0xC62C58F97DD949BF, 0xCD454F8F19C5126A, 0xBBE83F4ECC2BDECB,
+    0xDC842B7E2819E230, 0xBA89142E007503B8, 0xA3BC941D0A5061CB, 0xE9F6760E32CD8021,
+    0x09C7E552BC76492F, 0x852F54934DA55CC9, 0x8107FCCF064FCF56, 0x098954D51FFF6580,
+    0x23B70EDB1955C4BF, 0xC330DE426430F69D, 0x4715ED43E8A45C0A, 0xA8D7E4DAB780A08D,
+    0x0572B974F03CE0BB, 0xB57D2E985E1419C7, 0xE8D9ECBE2CF3D73F, 0x2FE4B17170E59750,
+    0x11317BA87905E790, 0x7FBF21EC8A1F45EC, 0x1725CABFCB045B00, 0x964E915CD5E2B207,
+    0x3E2B8BCBF016D66D, 0xBE7444E39328A0AC, 0xF85B2B4FBCDE44B7, 0x49353FEA39BA63B1,
+    0x1DD01AAFCD53486A, 0x1FCA8A92FD719F85, 0xFC7C95D827357AFA, 0x18A6A990C8B35EBD,
+    0xCCCB7005C6B9C28D, 0x3BDBB92C43B17F26, 0xAA70B5B4F89695A2, 0xE94C39A54A98307F,
+    0xB7A0B174CFF6F36E, 0xD4DBA84729AF48AD, 0x2E18BC1AD9704A68, 0x2DE0966DAF2F8B1C,
+    0xB9C11D5B1E43A07E, 0x64972D68DEE33360, 0x94628D38D0C20584, 0xDBC0D2B6AB90A559,
+    0xD2733C4335C6A72F, 0x7E75D99D94A70F4D, 0x6CED1983376FA72B, 0x97FCAACBF030BC24,
+    0x7B77497B32503B12, 0x8547EDDFB81CCB94, 0x79999CDFF70902CB, 0xCFFE1939438E9B24,
+    0x829626E3892D95D7, 0x92FAE24291F2B3F1, 0x63E22C147B9C3403, 0xC678B6D860284A1C,
+    0x5873888850659AE7, 0x0981DCD296A8736D, 0x9F65789A6509A440, 0x9FF38FED72E9052F,
+    0xE479EE5B9930578C, 0xE7F28ECD2D49EECD, 0x56C074A581EA17FE, 0x5544F7D774B14AEF,
+    0x7B3F0195FC6F290F, 0x12153635B2C0CF57, 0x7F5126DBBA5E0CA7, 0x7A76956C3EAFB413,
+    0x3D5774A11D31AB39, 0x8A1B083821F40CB4, 0x7B4A38E32537DF62, 0x950113646D1D6E03,
+    0x4DA8979A0041E8A9, 0x3BC36E078F7515D7, 0x5D0A12F27AD310D1, 0x7F9D1A2E1EBE1327,
+    0xDA3A361B1C5157B1, 0xDCDD7D20903D0C25, 0x36833336D068F707, 0xCE68341F79893389,
+    0xAB9090168DD05F34, 0x43954B3252DC25E5, 0xB438C2B67F98E5E9, 0x10DCD78E3851A492,
+    0xDBC27AB5447822BF, 0x9B3CDB65F82CA382, 0xB67B7896167B4C84, 0xBFCED1B0048EAC50,
+    0xA9119B60369FFEBD, 0x1FFF7AC80904BF45, 0xAC12FB171817EEE7, 0xAF08DA9177DDA93D,
+    0x1B0CAB936E65C744, 0xB559EB1D04E5E932, 0xC37B45B3F8D6F2BA, 0xC3A9DC228CAAC9E9,
+    0xF3B8B6675A6507FF, 0x9FC477DE4ED681DA, 0x67378D8ECCEF96CB, 0x6DD856D94D259236,
+    0xA319CE15B0B4DB31, 0x073973751F12DD5E, 0x8A8E849EB32781A5, 0xE1925C71285279F5,
+    0x74C04BF1790C0EFE, 0x4DDA48153C94938A, 0x9D266D6A1CC0542C, 0x7440FB816508C4FE,
+    0x13328503DF48229F, 0xD6BF7BAEE43CAC40, 0x4838D65F6EF6748F, 0x1E152328F3318DEA,
+    0x8F8419A348F296BF, 0x72C8834A5957B511, 0xD7A023A73260B45C, 0x94EBC8ABCFB56DAE,
+    0x9FC10D0F989993E0, 0xDE68A2355B93CAE6, 0xA44CFE79AE538BBE, 0x9D1D84FCCE371425,
+    0x51D2B1AB2DDFB636, 0x2FD7E4B9E72CD38C, 0x65CA5B96B7552210, 0xDD69A0D8AB3B546D,
+    0x604D51B25FBF70E2, 0x73AA8A564FB7AC9E, 0x1A8C1E992B941148, 0xAAC40A2703D9BEA0,
+    0x764DBEAE7FA4F3A6, 0x1E99B96E70A9BE8B, 0x2C5E9DEB57EF4743, 0x3A938FEE32D29981,
+    0x26E6DB8FFDF5ADFE, 0x469356C504EC9F9D, 0xC8763C5B08D1908C, 0x3F6C6AF859D80055,
+    0x7F7CC39420A3A545, 0x9BFB227EBDF4C5CE, 0x89039D79D6FC5C5C, 0x8FE88B57305E2AB6,
+    0xA09E8C8C35AB96DE, 0xFA7E393983325753, 0xD6B6D0ECC617C699, 0xDFEA21EA9E7557E3,
+    0xB67C1FA481680AF8, 0xCA1E3785A9E724E5, 0x1CFC8BED0D681639, 0xD18D8549D140CAEA,
+    0x4ED0FE7E9DC91335, 0xE4DBF0634473F5D2, 0x1761F93A44D5AEFE, 0x53898E4C3910DA55,
+    0x734DE8181F6EC39A, 0x2680B122BAA28D97, 0x298AF231C85BAFAB, 0x7983EED3740847D5,
+    0x66C1A2A1A60CD889, 0x9E17E49642A3E4C1, 0xEDB454E7BADC0805, 0x50B704CAB602C329,
+    0x4CC317FB9CDDD023, 0x66B4835D9EAFEA22, 0x219B97E26FFC81BD, 0x261E4E4C0A333A9D,
+    0x1FE2CCA76517DB90, 0xD7504DFA8816EDBB, 0xB9571FA04DC089C8, 0x1DDC0325259B27DE,
+    0xCF3F4688801EB9AA, 0xF4F5D05C10CAB243, 0x38B6525C21A42B0E, 0x36F60E2BA4FA6800,
+    0xEB3593803173E0CE, 0x9C4CD6257C5A3603, 0xAF0C317D32ADAA8A, 0x258E5A80C7204C4B,
+    0x8B889D624D44885D, 0xF4D14597E660F855, 0xD4347F66EC8941C3, 0xE699ED85B0DFB40D,
+    0x2472F6207C2D0484, 0xC2A1E7B5B459AEB5, 0xAB4F6451CC1D45EC, 0x63767572AE3D6174,
+    0xA59E0BD101731A28, 0x116D0016CB948F09, 0x2CF9C8CA052F6E9F, 0x0B090A7560A968E3,
+    0xABEEDDB2DDE06FF1, 0x58EFC10B06A2068D, 0xC6E57A78FBD986E0, 0x2EAB8CA63CE802D7,
+    0x14A195640116F336, 0x7C0828DD624EC390, 0xD74BBE77E6116AC7, 0x804456AF10F5FB53,
+    0xEBE9EA2ADF4321C7, 0x03219A39EE587A30, 0x49787FEF17AF9924, 0xA1E9300CD8520548,
+    0x5B45E522E4B1B4EF, 0xB49C3B3995091A36, 0xD4490AD526F14431, 0x12A8F216AF9418C2,
+    0x001F837CC7350524, 0x1877B51E57A764D5, 0xA2853B80F17F58EE, 0x993E1DE72D36D310,
+    0xB3598080CE64A656, 0x252F59CF0D9F04BB, 0xD23C8E176D113600, 0x1BDA0492E7E4586E,
+    0x21E0BD5026C619BF, 0x3B097ADAF088F94E, 0x8D14DEDB30BE846E, 0xF95CFFA23AF5F6F4,
+    0x3871700761B3F743, 0xCA672B91E9E4FA16, 0x64C8E531BFF53B55, 0x241260ED4AD1E87D,
+    0x106C09B972D2E822, 0x7FBA195410E5CA30, 0x7884D9BC6CB569D8, 0x0647DFEDCD894A29,
+    0x63573FF03E224774, 0x4FC8E9560F91B123, 0x1DB956E450275779, 0xB8D91274B9E9D4FB,
+    0xA2EBEE47E2FBFCE1, 0xD9F1F30CCD97FB09, 0xEFED53D75FD64E6B, 0x2E6D02C36017F67F,
+    0xA9AA4D20DB084E9B, 0xB64BE8D8B25396C1, 0x70CB6AF7C2D5BCF0, 0x98F076A4F7A2322E,
+    0xBF84470805E69B5F, 0x94C3251F06F90CF3, 0x3E003E616A6591E9, 0xB925A6CD0421AFF3,
+    0x61BDD1307C66E300, 0xBF8D5108E27E0D48, 0x240AB57A8B888B20, 0xFC87614BAF287E07,
+    0xEF02CDD06FFDB432, 0xA1082C0466DF6C0A, 0x8215E577001332C8, 0xD39BB9C3A48DB6CF,
+    0x2738259634305C14, 0x61CF4F94C97DF93D, 0x1B6BACA2AE4E125B, 0x758F450C88572E0B,
+    0x959F587D507A8359, 0xB063E962E045F54D, 0x60E8ED72C0DFF5D1, 0x7B64978555326F9F,
+    0xFD080D236DA814BA, 0x8C90FD9B083F4558, 0x106F72FE81E2C590, 0x7976033A39F7D952,
+    0xA4EC0132764CA04B, 0x733EA705FAE4FA77, 0xB4D8F77BC3E56167, 0x9E21F4F903B33FD9,
+    0x9D765E419FB69F6D, 0xD30C088BA61EA5EF, 0x5D94337FBFAF7F5B, 0x1A4E4822EB4D7A59,
+    0x6FFE73E81B637FB3, 0xDDF957BC36D8B9CA, 0x64D0E29EEA8838B3, 0x08DD9BDFD96B9F63,
+    0x087E79E5A57D1D13, 0xE328E230E3E2B3FB, 0x1C2559E30F0946BE, 0x720BF5F26F4D2EAA,
+    0xB0774D261CC609DB, 0x443F64EC5A371195, 0x4112CF68649A260E, 0xD813F2FAB7F5C5CA,
+    0x660D3257380841EE, 0x59AC2C7873F910A3, 0xE846963877671A17, 0x93B633ABFA3469F8,
+    0xC0C0F5A60EF4CDCF, 0xCAF21ECD4377B28C, 0x57277707199B8175, 0x506C11B9D90E8B1D,
+    0xD83CC2687A19255F, 0x4A29C6465A314CD1, 0xED2DF21216235097, 0xB5635C95FF7296E2,
+    0x22AF003AB672E811, 0x52E762596BF68235, 0x9AEBA33AC6ECC6B0, 0x944F6DE09134DFB6,
+    0x6C47BEC883A7DE39, 0x6AD047C430A12104, 0xA5B1CFDBA0AB4067, 0x7C45D833AFF07862,
+    0x5092EF950A16DA0B, 0x9338E69C052B8E7B, 0x455A4B4CFE30E3F5, 0x6B02E63195AD0CF8,
+    0x6B17B224BAD6BF27, 0xD1E0CCD25BB9C169, 0xDE0C89A556B9AE70, 0x50065E535A213CF6,
+    0x9C1169FA2777B874, 0x78EDEFD694AF1EED, 0x6DC93D9526A50E68, 0xEE97F453F06791ED,
+    0x32AB0EDB696703D3, 0x3A6853C7E70757A7, 0x31865CED6120F37D, 0x67FEF95D92607890,
+    0x1F2B1D1F15F6DC9C, 0xB69E38A8965C6B65, 0xAA9119FF184CCCF4, 0xF43C732873F24C13,
+    0xFB4A3D794A9A80D2, 0x3550C2321FD6109C, 0x371F77E76BB8417E, 0x6BFA9AAE5EC05779,
+    0xCD04F3FF001A4778, 0xE3273522064480CA, 0x9F91508BFFCFC14A, 0x049A7F41061A9E60,
+    0xFCB6BE43A9F2FE9B, 0x08DE8A1C7797DA9B, 0x8F9887E6078735A1, 0xB5B4071DBFC73A66,
+    0x230E343DFBA08D33, 0x43ED7F5A0FAE657D, 0x3A88A0FBBCB05C63, 0x21874B8B4D2DBC4F,
+    0x1BDEA12E35F6A8C9, 0x53C065C6C8E63528, 0xE34A1D250E7A8D6B, 0xD6B04D3B7651DD7E,
+    0x5E90277E7CB39E2D, 0x2C046F22062DC67D, 0xB10BB459132D0A26, 0x3FA9DDFB67E2F199,
+    0x0E09B88E1914F7AF, 0x10E8B35AF3EEAB37, 0x9EEDECA8E272B933, 0xD4C718BC4AE8AE5F,
+    0x81536D601170FC20, 0x91B534F885818A06, 0xEC8177F83F900978, 0x190E714FADA5156E,
+    0xB592BF39B0364963, 0x89C350C893AE7DC1, 0xAC042E70F8B383F2, 0xB49B52E587A1EE60,
+    0xFB152FE3FF26DA89, 0x3E666E6F69AE2C15, 0x3B544EBE544C19F9, 0xE805A1E290CF2456,
+    0x24B33C9D7ED25117, 0xE74733427B72F0C1, 0x0A804D18B7097475, 0x57E3306D881EDB4F,
+    0x4AE7D6A36EB5DBCB, 0x2D8D5432157064C8, 0xD1E649DE1E7F268B, 0x8A328A1CEDFE552C,
+    0x07A3AEC79624C7DA, 0x84547DDC3E203C94, 0x990A98FD5071D263, 0x1A4FF12616EEFC89,
+    0xF6F7FD1431714200, 0x30C05B1BA332F41C, 0x8D2636B81555A786, 0x46C9FEB55D120902,
+    0xCCEC0A73B49C9921, 0x4E9D2827355FC492, 0x19EBB029435DCB0F, 0x4659D2B743848A2C,
+    0x963EF2C96B33BE31, 0x74F85198B05A2E7D, 0x5A0F544DD2B1FB18, 0x03727073C2E134B1,
+    0xC7F6AA2DE59AEA61, 0x352787BAA0D7C22F, 0x9853EAB63B5E0B35, 0xABBDCDD7ED5C0860,
+    0xCF05DAF5AC8D77B0, 0x49CAD48CEBF4A71E, 0x7A4C10EC2158C4A6, 0xD9E92AA246BF719E,
+    0x13AE978D09FE5557, 0x730499AF921549FF, 0x4E4B705B92903BA4, 0xFF577222C14F0A3A,
+    0x55B6344CF97AAFAE, 0xB862225B055B6960, 0xCAC09AFBDDD2CDB4, 0xDAF8E9829FE96B5F,
+    0xB5FDFC5D3132C498, 0x310CB380DB6F7503, 0xE87FBB46217A360E, 0x2102AE466EBB1148,
+    0xF8549E1A3AA5E00D, 0x07A69AFDCC42261A, 0xC4C118BFE78FEAAE, 0xF9F4892ED96BD438,
+    0x1AF3DBE25D8F45DA, 0xF5B4B0B0D2DEEEB4, 0x962ACEEFA82E1C84, 0x046E3ECAAF453CE9,
+    0xF05D129681949A4C, 0x964781CE734B3C84, 0x9C2ED44081CE5FBD, 0x522E23F3925E319E,
+    0x177E00F9FC32F791, 0x2BC60A63A6F3B3F2, 0x222BBFAE61725606, 0x486289DDCC3D6780,
+    0x7DC7785B8EFDFC80, 0x8AF38731C02BA980, 0x1FAB64EA29A2DDF7, 0xE4D9429322CD065A,
+    0x9DA058C67844F20C, 0x24C0E332B70019B0, 0x233003B5A6CFE6AD, 0xD586BD01C5C217F6,
+    0x5E5637885F29BC2B, 0x7EBA726D8C94094B, 0x0A56A5F0BFE39272, 0xD79476A84EE20D06,
+    0x9E4C1269BAA4BF37, 0x17EFEE45B0DEE640, 0x1D95B0A5FCF90BC6, 0x93CBE0B699C2585D,
+    0x65FA4F227A2B6D79, 0xD5F9E858292504D5, 0xC2B5A03F71471A6F, 0x59300222B4561E00,
+    0xCE2F8642CA0712DC, 0x7CA9723FBB2E8988, 0x2785338347F2BA08, 0xC61BB3A141E50E8C,
+    0x150F361DAB9DEC26, 0x9F6A419D382595F4, 0x64A53DC924FE7AC9, 0x142DE49FFF7A7C3D,
+    0x0C335248857FA9E7, 0x0A9C32D5EAE45305, 0xE6C42178C4BBB92E, 0x71F1CE2490D20B07,
+    0xF1BCC3D275AFE51A, 0xE728E8C83C334074, 0x96FBF83A12884624, 0x81A1549FD6573DA5,
+    0x5FA7867CAF35E149, 0x56986E2EF3ED091B, 0x917F1DD5F8886C61, 0xD20D8C88C8FFE65F,
+    0x31D71DCE64B2C310, 0xF165B587DF898190, 0xA57E6339DD2CF3A0, 0x1EF6E6DBB1961EC9,
+    0x70CC73D90BC26E24, 0xE21A6B35DF0C3AD7, 0x003A93D8B2806962, 0x1C99DED33CB890A1,
+    0xCF3145DE0ADD4289, 0xD0E4427A5514FB72, 0x77C621CC9FB3A483, 0x67A34DAC4356550B,
+    0xF8D626AAAF278509
+};
+const int pg_castle=768; const int pg_en_passant=772; const int pg_turn=780;
+
 uint64_t gen_zobrist_key(int side_to_move) {
-    uint64_t key = 0;
+    PROFILE(PROFILE_ZOBRIST_KEY);
+    // the pieces are already hashed incrementally, only side, castling and en passant are added
+    uint64_t key = (piece_key ^ CASTLING_TABLE[castling_rights]);
     if (side_to_move == black) {
         key ^= SIDE;
     }
-
-    for (int i=0; i<64; i++) {
-        if ((en_passant_w | en_passant_b) & (1ULL << i)) {
-            key ^= EN_PASSANT_TABLE[i];
-        }
-
-        for (int piece=0; piece<12; piece++) {
-            if (pos[piece] & (1ULL << i)) {
-                key ^= PIECE_TABLE[piece][i];
-            }
-        }
-    }
+    if (en_passant_w) { key ^= EN_PASSANT_TABLE[bit_scan_left(en_passant_w)]; }
+    if (en_passant_b) { key ^= EN_PASSANT_TABLE[bit_scan_left(en_passant_b)]; }
 
     return key;
 }
 
 int gen_hash_index(uint64_t key) {
-    return (key % HASH_TABLE_LENGTH);
+    unsigned __int128 fraction = hash_table_reciprocal * key;
+    uint64_t low = (uint64_t)(((fraction & UINT64_MAX) * (unsigned __int128)hash_table_length) >> 64);
+    return (int)((low + (fraction >> 64) * (unsigned __int128)hash_table_length) >> 64);
+}
+
+void prefetch_hash_entry(int hash) {
+    // start loading an entry that will be probed soon, so the miss overlaps other work
+    __builtin_prefetch(&HASH_TABLE[hash]);
 }
 
 void clear_hash_table() {
-    for (int i=0; i<HASH_TABLE_LENGTH; i++) {
-        for (int j=0; j<3; j++) {
-            HASH_TABLE[i][j] = 0;
-        }
+    for (int i=0; i<hash_table_length; i++) {
+        write_hash_entry(i, HashEntry());
+    }
+}
+
+// entries stored at least this deep are also logged, for a distributed worker to pass
+// on to the others (never, unless a worker turns it on)
+thread_local int share_depth = MAX_DEPTH;
+thread_local std::vector<HashEntry> shared_entries;
+
+void store_shared_entry(const HashEntry& entry) {
+    // the same rule as the search
+    int hash = gen_hash_index(entry.key);
+    HashEntry slot;
+    if (!read_hash_entry(hash, entry.key, slot) || replaces_hash_entry(slot, entry)) { write_hash_entry(hash, entry); }
+}
+
+// hash table snapshots, so a long analysis survives a restart.  The file is a header
+// followed by the decoded entries, which are only usable by a build with the same table
+// geometry, entry layout and zobrist keys.  The versions catch deliberate key and layout
+// changes and the fingerprint catches the key changes nobody remembered to version
+struct HashSnapshotHeader {
+    char magic[8];
+    uint16_t version;       // ZOBRIST_VERSION
+    uint16_t entry_version; // HASH_ENTRY_VERSION
+    uint32_t entry_size;
+    uint64_t length;
+    uint64_t fingerprint;
+};
+const char HASH_SNAPSHOT_MAGIC[8] = {'K', 'I', 'T', 'T', 'Y', 'T', 'T', '\0'};
+const uint16_t HASH_ENTRY_VERSION = 1; // bump when the entry's fields change (1: bound types)
+
+uint64_t zobrist_fingerprint() {
+    const uint64_t* keys = (const uint64_t*)&ZOBRIST_KEYS;
+    uint64_t fingerprint = 0;
+    for (size_t i=0; i<(sizeof(ZobristKeys) / 8); i++) {
+        fingerprint = ((fingerprint << 7) | (fingerprint >> 57)) ^ keys[i];
+    }
+    return fingerprint;
+}
+
+HashSnapshotHeader hash_snapshot_header() {
+    HashSnapshotHeader header = {};
+    memcpy(header.magic, HASH_SNAPSHOT_MAGIC, sizeof(header.magic));
+    header.version = ZOBRIST_VERSION;
+    header.entry_version = HASH_ENTRY_VERSION;
+    header.entry_size = sizeof(HashEntry);
+    header.length = hash_table_length;
+    header.fingerprint = zobrist_fingerprint();
+    return header;
+}
+
+bool save_hash_table(const std::string& path) {
+    // written to a temporary file and renamed, so a crash never leaves half a snapshot
+    std::string temporary = path + ".tmp";
+    FILE* file = fopen(temporary.c_str(), "wb");
+    if (file == nullptr) { std::cout << "CANNOT WRITE " << path << std::endl; return false; }
+    HashSnapshotHeader header = hash_snapshot_header();
+    bool written = (fwrite(&header, sizeof(header), 1, file) == 1);
+    HashEntry chunk[4096];
+    for (int i=0; written && (i<hash_table_length); i+=4096) {
+        int n = std::min(4096, hash_table_length - i);
+        for (int j=0; j<n; j++) { chunk[j] = read_hash_slot(i + j); }
+        written = (fwrite(chunk, sizeof(HashEntry), n, file) == (size_t)n);
+    }
+    written = (fclose(file) == 0) && written;
+    if (!written || (rename(temporary.c_str(), path.c_str()) != 0)) {
+        unlink(temporary.c_str());
+        std::cout << "CANNOT WRITE " << path << std::endl;
+        return false;
+    }
+    return true;
+}
+
+bool load_hash_table(const std::string& path) {
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) { std::cout << "CANNOT OPEN " << path << std::endl; return false; }
+    struct stat info;
+    size_t bytes = sizeof(HashSnapshotHeader) + (sizeof(HashEntry) * hash_table_length);
+    if ((fstat(fd, &info) != 0) || ((size_t)info.st_size != bytes)) {
+        close(fd);
+        std::cout << "HASH TABLE SIZE MISMATCH IN " << path << std::endl;
+        return false;
+    }
+
+    void* data = mmap(nullptr, bytes, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) { std::cout << "CANNOT OPEN " << path << std::endl; return false; }
+    madvise(data, bytes, MADV_SEQUENTIAL);
+
+    HashSnapshotHeader header = hash_snapshot_header();
+    bool matches = (memcmp(data, &header, sizeof(header)) == 0);
+    if (matches) {
+        const HashEntry* entries = (const HashEntry*)((const char*)data + sizeof(header));
+        for (int i=0; i<hash_table_length; i++) { write_hash_entry(i, entries[i]); }
     }
+    else { std::cout << "HASH TABLE FROM DIFFERENT KEYS OR ENTRY LAYOUT IN " << path << std::endl; }
+    munmap(data, bytes);
+    return matches;
 }
 
 /////////////////////////////////////////////////////////////////////////////////////
@@ -447,10 +1415,7 @@ uint64_t gen_wP_forward(int i) {
 
 uint64_t gen_wP_attks(int i) { 
     // white pawns attack diagonally up if there is a piece to take
-    uint64_t bits = (1ULL << i);
-    if (bits & FILE_A) { return (bits << 7); }
-    else if (bits & FILE_H) { return (bits << 9); }
-    else { return ((bits << 9) | (bits << 7)); }
+    return ATTACK_TABLES.pawn[0][i];
 }
 
 uint64_t gen_wP_moves(int i) {
@@ -469,18 +1434,7 @@ uint64_t gen_bP_forward(int i) {
 
 uint64_t gen_bP_attks(int i) { 
     // black pawns attack diagonally down if there is a piece to take
-    uint64_t bits = (1ULL << i);
-    if (bits & FILE_A) {
-        return (bits >> 9);
-    }
-
-    else if (bits & FILE_H) {
-        return (bits >> 7);
-    }
-
-    else {
-        return ((bits >> 7) | (bits >> 9));
-    }
+    return ATTACK_TABLES.pawn[1][i];
 }
 
 uint64_t gen_bP_moves(int i) {
@@ -489,61 +1443,35 @@ uint64_t gen_bP_moves(int i) {
 
 uint64_t gen_N_moves(int i) {
     // knights jump with a 2x3 pattern once in any direction if they stay in bounds
-    uint64_t bits = (1ULL << i); 
-
-    if (bits & FILE_A) { 
-        return ((bits << 15) | (bits << 6) | (bits >> 10) | (bits >> 17));
-    }
-
-    else if (bits & FILE_B) {
-        return ((bits << 17) | (bits << 15) | (bits << 6) | (bits >> 10) | (bits >> 15) | (bits >> 17));
-    }
-
-    else if (bits & FILE_G) {
-        return ((bits << 17) | (bits << 15) | (bits << 10) | (bits >> 6) | (bits >> 15) | (bits >> 17));
-    }
-
-    else if (bits & FILE_H) {
-        return ((bits << 17) | (bits << 10) | (bits >> 6) | (bits >> 15));
-    }
-
-    else {
-        return ((bits << 17) | (bits << 15) | (bits << 10) | (bits << 6) | (bits >> 6) | (bits >> 10) | (bits >> 15) | (bits >> 17));
-    }
+    return ATTACK_TABLES.knight[i];
 }
 
-uint64_t gen_K_moves(int i) {
+// the generators below are templated on the color of the moving piece, so the color
+// tests compile away.  The untemplated generate_piece_moves and generate_piece_attacks
+// look the color up on the board for callers that don't know it
+template<int color> uint64_t gen_K_moves(int i) {
     // king moves one square in any direction if it stays in bounds or castles if legal
-    uint64_t bits = (1ULL << i);
-    uint64_t moves = 0;
-    int color;
-    
-    if (pos[white] & (1ULL << i)) { color = white; }
-    else { color = black; }
-
-    moves |= ((bits << 9) | (bits << 8) | (bits << 7) | (bits << 1) | (bits >> 1) | (bits >> 7) | (bits >> 8) | (bits >> 9));
-
-    if (bits & FILE_A) { moves ^= ((bits << 9) | (bits << 1) | (bits >> 7)); }
-    else if (bits & FILE_H) { moves ^= ((bits << 7) | (bits >> 1) | (bits >> 9)); }
+    uint64_t moves = ATTACK_TABLES.king[i];
 
-    if ((color == white) && (is_castled_w == false)) {
+    // a castling right means the king and that rook have never moved
+    if (color == white) {
         // short castle
-        if ((i == 3) && (pos[wR] & (1ULL << 0)) && ((pos[empty] & W_SHORT_CASTLE_ZONE) == W_SHORT_CASTLE_ZONE)) {
+        if ((castling_rights & W_SHORT) && ((pos[empty] & W_SHORT_CASTLE_ZONE) == W_SHORT_CASTLE_ZONE)) {
             moves |= (1ULL << 1);
         }
         // long castle
-        if ((i == 3) && (pos[wR] & (1ULL << 7)) && ((pos[empty] & W_LONG_CASTLE_ZONE) == W_LONG_CASTLE_ZONE)) {
+        if ((castling_rights & W_LONG) && ((pos[empty] & W_LONG_CASTLE_ZONE) == W_LONG_CASTLE_ZONE)) {
             moves |= (1ULL << 5);
         }
     }
 
-    if ((color == black) && (is_castled_b == false)) {
+    if (color == black) {
         // short castle
-        if ((i == 59) && (pos[bR] & (1ULL << 56)) && ((pos[empty] & B_SHORT_CASTLE_ZONE) == B_SHORT_CASTLE_ZONE)) {
+        if ((castling_rights & B_SHORT) && ((pos[empty] & B_SHORT_CASTLE_ZONE) == B_SHORT_CASTLE_ZONE)) {
             moves |= (1ULL << 57);
         }
         // long castle
-        if ((i == 59) && (pos[bR] & (1ULL << 63)) && ((pos[empty] & B_LONG_CASTLE_ZONE) == B_LONG_CASTLE_ZONE)) {
+        if ((castling_rights & B_LONG) && ((pos[empty] & B_LONG_CASTLE_ZONE) == B_LONG_CASTLE_ZONE)) {
             moves |= (1ULL << 61);
         }
     }
@@ -551,13 +1479,11 @@ uint64_t gen_K_moves(int i) {
     return moves;
 }
 
-uint64_t gen_R_moves(int i) {
+template<int color> uint64_t gen_R_moves(int i) {
     // rooks move along rank and file rays if they are not blocked
     uint64_t moves = 0;
     int blocker_index;
-    uint64_t blockers;
-    if (pos[white] & (1ULL << i)) { blockers = ~(pos[empty] | pos[bK]); }
-    else { blockers = ~(pos[empty] | pos[wK]); }
+    uint64_t blockers = ~(pos[empty] | pos[(color == white) ? bK : wK]);
 
     moves |= RAYS[i][nrt]; // north
     if (RAYS[i][nrt] & blockers) {
@@ -586,13 +1512,11 @@ uint64_t gen_R_moves(int i) {
     return moves;
 }
 
-uint64_t gen_B_moves(int i) {
+template<int color> uint64_t gen_B_moves(int i) {
     // bishops move along diagonal rays if they are not blocked
     uint64_t moves = 0;
     int blocker_index;
-    uint64_t blockers;
-    if (pos[white] & (1ULL << i)) { blockers = ~(pos[empty] | pos[bK]); }
-    else { blockers = ~(pos[empty] | pos[wK]); }
+    uint64_t blockers = ~(pos[empty] | pos[(color == white) ? bK : wK]);
 
     moves |= RAYS[i][nrtest]; // north east
     if (RAYS[i][nrtest] & blockers) {
@@ -621,250 +1545,229 @@ uint64_t gen_B_moves(int i) {
     return moves; 
 }
 
-uint64_t gen_Q_moves(int i) {
+template<int color> uint64_t gen_Q_moves(int i) {
     // queens make any rook or bishop move
-    return (gen_R_moves(i) | gen_B_moves(i));
+    return (gen_R_moves<color>(i) | gen_B_moves<color>(i));
+}
+
+template<int color> uint64_t generate_piece_moves(int i) {
+    // first piece ID of the color: wP or bP
+    const int own = ((color == white) ? wP : bP);
+    if (pos[own+wP] & (1ULL << i)) { return ((color == white) ? gen_wP_moves(i) : gen_bP_moves(i)); }
+    else if (pos[own+wN] & (1ULL << i)) { return gen_N_moves(i); }
+    else if (pos[own+wB] & (1ULL << i)) { return gen_B_moves<color>(i); }
+    else if (pos[own+wR] & (1ULL << i)) { return gen_R_moves<color>(i); }
+    else if (pos[own+wQ] & (1ULL << i)) { return gen_Q_moves<color>(i); }
+    else { return gen_K_moves<color>(i); }
+}
+
+template<int color> uint64_t generate_piece_attacks(int i) {
+    const int own = ((color == white) ? wP : bP);
+    if (pos[own+wP] & (1ULL << i)) { return ((color == white) ? gen_wP_attks(i) : gen_bP_attks(i)); }
+    else if (pos[own+wN] & (1ULL << i)) { return gen_N_moves(i); }
+    else if (pos[own+wB] & (1ULL << i)) { return gen_B_moves<color>(i); }
+    else if (pos[own+wR] & (1ULL << i)) { return gen_R_moves<color>(i); }
+    else if (pos[own+wQ] & (1ULL << i)) { return gen_Q_moves<color>(i); }
+    else { return gen_K_moves<color>(i); }
 }
 
 uint64_t generate_piece_moves(int i) {
-    if (pos[wP] & (1ULL << i)) { return gen_wP_moves(i); }
-    else if (pos[bP] & (1ULL << i)) { return gen_bP_moves(i); }
-    else if ((pos[wN] | pos[bN]) & (1ULL << i)) { return gen_N_moves(i); }
-    else if ((pos[wB] | pos[bB]) & (1ULL << i)) { return gen_B_moves(i); }
-    else if ((pos[wR] | pos[bR]) & (1ULL << i)) { return gen_R_moves(i); }
-    else if ((pos[wQ] | pos[bQ]) & (1ULL << i)) { return gen_Q_moves(i); }
-    else if ((pos[wK] | pos[bK]) & (1ULL << i)) { return gen_K_moves(i); }
+    if (pos[white] & (1ULL << i)) { return generate_piece_moves<white>(i); }
+    else if (pos[black] & (1ULL << i)) { return generate_piece_moves<black>(i); }
+    else { return 0; }
 }
 
 uint64_t generate_piece_attacks(int i) {
-    if (pos[wP] & (1ULL << i)) { return gen_wP_attks(i); }
-    else if (pos[bP] & (1ULL << i)) { return gen_bP_attks(i); }
-    else if ((pos[wN] | pos[bN]) & (1ULL << i)) { return gen_N_moves(i); }
-    else if ((pos[wB] | pos[bB]) & (1ULL << i)) { return gen_B_moves(i); }
-    else if ((pos[wR] | pos[bR]) & (1ULL << i)) { return gen_R_moves(i); }
-    else if ((pos[wQ] | pos[bQ]) & (1ULL << i)) { return gen_Q_moves(i); }
-    else if ((pos[wK] | pos[bK]) & (1ULL << i)) { return gen_K_moves(i); }
+    if (pos[white] & (1ULL << i)) { return generate_piece_attacks<white>(i); }
+    else if (pos[black] & (1ULL << i)) { return generate_piece_attacks<black>(i); }
+    else { return 0; }
 }
 
 /////////////////////////////////////////////////////////////////////////////////////
 // BOARD MANIPULATION
 // methods for making and taking back moves
 /////////////////////////////////////////////////////////////////////////////////////
-void short_castle(int color, int depth) {
-    if (color == white) {
-        pos[wK] = (1ULL << 1);
-        pos[wR] ^= (1ULL << 0);
-        pos[wR] |= (1ULL << 2);
-        capture_sequence[depth-1] = w_castle_short;
-        is_castled_w = true;
-    }
+void add_piece(int piece, int index) {
+    // every change to the board goes through these so the keys, material and network
+    // accumulator stay in step with the bitboards
+    pos[piece] |= (1ULL << index);
+    hash_piece(piece, index);
+    material_add(piece);
+    nnue_add_feature(piece, index);
+}
 
-    else {
-        pos[bK] = (1ULL << 57);
-        pos[bR] ^= (1ULL << 56);
-        pos[bR] |= (1ULL << 58);
-        capture_sequence[depth-1] = b_castle_short;
-        is_castled_b = true;
-    }
-    update_colors();
+void remove_piece(int piece, int index) {
+    pos[piece] ^= (1ULL << index);
+    hash_piece(piece, index);
+    material_remove(piece);
+    nnue_remove_feature(piece, index);
 }
 
-void long_castle(int color, int depth) {
-    if (color == white) {
-        pos[wK] = (1ULL << 5);
-        pos[wR] ^= (1ULL << 7);
-        pos[wR] |= (1ULL << 4);
-        capture_sequence[depth-1] = w_castle_long;
-        is_castled_w = true;
-    }
+void move_piece(int piece, int origination, int destination) {
+    pos[piece] ^= ((1ULL << origination) | (1ULL << destination));
+    hash_piece(piece, origination); hash_piece(piece, destination);
+    nnue_remove_feature(piece, origination); nnue_add_feature(piece, destination);
+}
 
-    else {
-        pos[bK] = (1ULL << 61);
-        pos[bR] ^= (1ULL << 63);
-        pos[bR] |= (1ULL << 60);
-        capture_sequence[depth-1] = b_castle_long;    
-        is_castled_b = true;    
-    }
-    update_colors();
+// takeback_move only puts the bitboards and piece counts back, pop_state restores the
+// keys, material key and accumulator in one go
+void move_piece_back(int piece, int origination, int destination) {
+    pos[piece] ^= ((1ULL << origination) | (1ULL << destination));
 }
 
-void castle(int origination, int destination, int depth) {
-    if ((origination == 3) && (destination == 1)) { short_castle(white, depth); }
-    else if ((origination == 3) && (destination == 5)) { long_castle(white, depth); }
-    else if ((origination == 59) && (destination == 57)) { short_castle(black, depth); }
-    else { long_castle(black, depth); }
+void put_back_piece(int piece, int index) {
+    pos[piece] |= (1ULL << index);
+    piece_count[piece]++;
 }
 
-void promote(int origination, int destination, int depth) {
-    for (int i=0; i<13; i++) {
-        if (pos[i] & (1ULL << destination)) {
-            pos[i] ^= (1ULL << destination);
-            capture_sequence[depth-1] = (i + promotion_key);
-        }
-    }
+void take_off_piece(int piece, int index) {
+    pos[piece] ^= (1ULL << index);
+    piece_count[piece]--;
+}
 
-    if (RANK_8 & (1ULL << destination)) {
-        pos[wP] ^= (1ULL << origination);
-        pos[wQ] |= (1ULL << destination);
+void short_castle(int color) {
+    if (color == white) {
+        move_piece(wK, 3, 1);
+        move_piece(wR, 0, 2);
     }
 
     else {
-        pos[bP] ^= (1ULL << origination);
-        pos[bQ] |= (1ULL << destination);
+        move_piece(bK, 59, 57);
+        move_piece(bR, 56, 58);
     }
-    update_colors();
 }
 
-void make_move(int origination, int destination, int depth) {
-    if (en_passant_b & (1ULL << destination)) {
-        pos[wP] ^= (1ULL << origination);
-        pos[wP] |= (1ULL << destination);
-        pos[bP] ^= (1ULL << (destination-8));
-        capture_sequence[depth-1] = (bP+en_passant_key);
-    }
-    else if (en_passant_w & (1ULL << destination)) {
-        pos[bP] ^= (1ULL << origination);
-        pos[bP] |= (1ULL << destination);
-        pos[wP] ^= (1ULL << (destination+8));
-        capture_sequence[depth-1] = (wP+en_passant_key);
+void long_castle(int color) {
+    if (color == white) {
+        move_piece(wK, 3, 5);
+        move_piece(wR, 7, 4);
     }
-    else if (((pos[wK] | pos[bK]) & (1ULL << origination)) && (std::abs(origination - destination) == 2)) {
-        castle(origination, destination, depth);
+
+    else {
+        move_piece(bK, 59, 61);
+        move_piece(bR, 63, 60);
     }
+}
 
-    else if (((pos[wP] | pos[bP]) & (1ULL << origination)) && ((RANK_1 | RANK_8) & (1ULL << destination))) {
-        promote(origination, destination, depth);
+template<int color> void make_move(int move) {
+    // the flag says what kind of move it is and the moving piece belongs to color, so
+    // only the six piece boards of one side are searched for the piece that moves
+    PROFILE(PROFILE_MAKE_MOVE);
+    const int own = ((color == white) ? wP : bP);
+    const int enemy = ((color == white) ? bP : wP);
+    int origination = move_origination(move); int destination = move_destination(move);
+    int flag = move_flag(move);
+    int captured = empty;
+    if (flag == FLAG_EN_PASSANT) { captured = (enemy+wP); }
+    else if (flag & FLAG_CAPTURE) {
+        for (int i=enemy; i<enemy+6; i++) {
+            if (pos[i] & (1ULL << destination)) { captured = i; break; }
+        }
+    }
+    push_state(captured);
+    en_passant_w = 0; en_passant_b = 0;
+    castling_rights &= ~(CASTLING_LOST[origination] | CASTLING_LOST[destination]);
+    halfmove_clock++;
+
+    if (flag == FLAG_SHORT_CASTLE) { short_castle(color); }
+    else if (flag == FLAG_LONG_CASTLE) { long_castle(color); }
+    else if (flag == FLAG_EN_PASSANT) {
+        move_piece(own+wP, origination, destination);
+        remove_piece(captured, ((color == white) ? (destination-8) : (destination+8)));
+        halfmove_clock = 0;
     }
     else {
         // remove enemy piece
-        for (int i=0; i<13; i++) {
-            if (pos[i] & (1ULL << destination)) {
-                pos[i] ^= (1ULL << destination);
-                capture_sequence[depth-1] = i;
-            }
+        if (captured != empty) {
+            remove_piece(captured, destination);
+            halfmove_clock = 0;
         }
         // move own piece
-        for (int i=0; i<13; i++) {
-            if (pos[i] & (1ULL << origination)) {
-                pos[i] ^= (1ULL << origination);
-                pos[i] |= (1ULL << destination);
+        if (flag & FLAG_PROMOTION) {
+            remove_piece(own+wP, origination);
+            add_piece(own+promotion_piece(move), destination);
+            halfmove_clock = 0;
+        }
+        else {
+            for (int i=own; i<own+6; i++) {
+                if (pos[i] & (1ULL << origination)) {
+                    move_piece(i, origination, destination);
+                    if (i == own+wP) { halfmove_clock = 0; }
+                    break;
+                }
             }
         }
-    }
-
-    en_passant_w = 0; en_passant_b = 0;
-    if ((pos[wP] & (1ULL << origination)) && ((destination-origination) == 16)) {
-        en_passant_w = (1ULL << (origination+8));
-    }
-    else if ((pos[bP] & (1ULL << origination)) && ((origination-destination) == 16)) {
-        en_passant_b = (1ULL << (origination-8));
+        if (flag == FLAG_DOUBLE_PUSH) {
+            if (color == white) { en_passant_w = (1ULL << (origination+8)); }
+            else { en_passant_b = (1ULL << (origination-8)); }
+        }
     }
 
     update_colors();
 }
 
-void takeback_move(int origination, int destination, int depth) {
-    // castling
-    if (capture_sequence[depth-1] == w_castle_short) {
-        pos[wK] = (1ULL << 3);
-        pos[wR] ^= (1ULL << 2);
-        pos[wR] |= (1ULL << 0);
-        is_castled_w = false;
-    }
-    else if (capture_sequence[depth-1] == w_castle_long) {
-        pos[wK] = (1ULL << 3);
-        pos[wR] ^= (1ULL << 4);
-        pos[wR] |= (1ULL << 7);   
-        is_castled_w = false;        
-    }
-    else if (capture_sequence[depth-1] == b_castle_short) {
-        pos[bK] = (1ULL << 59);
-        pos[bR] ^= (1ULL << 58);
-        pos[bR] |= (1ULL << 56);
-        is_castled_b = false;
-    }
-    else if (capture_sequence[depth-1] == b_castle_long) {
-        pos[bK] = (1ULL << 59);
-        pos[bR] ^= (1ULL << 60);
-        pos[bR] |= (1ULL << 63);
-        is_castled_b = false;
-    }
-    // en passant and promotion
-    else if (capture_sequence[depth-1] >= 17) {
-        if (pos[wQ] & RANK_8 & (1ULL << destination)) {
-            pos[wQ] ^= (1ULL << destination);
-            pos[wP] |= (1ULL << origination);
-            pos[capture_sequence[depth-1] - promotion_key] |= (1ULL << destination);
-        }
-        else if (pos[bQ] & RANK_1 & (1ULL << destination)) {
-            pos[bQ] ^= (1ULL << destination);
-            pos[bP] |= (1ULL << origination);
-            pos[capture_sequence[depth-1] - promotion_key] |= (1ULL << destination);
-        }
-        else if ((capture_sequence[depth-1] - en_passant_key) == bP) {
-            pos[wP] ^= (1ULL << destination);
-            pos[wP] |= (1ULL << origination);
-            pos[bP] |= (1ULL << (destination-8));
-            en_passant_b = (1ULL << destination);
-        }
-        else if ((capture_sequence[depth-1] - en_passant_key) == wP) {
-            pos[bP] ^= (1ULL << destination);
-            pos[bP] |= (1ULL << origination);
-            pos[wP] |= (1ULL << (destination+8));
-            en_passant_w = (1ULL << destination);
-        }
-    }
-    // standard moves
+void make_move(int move) {
+    if (pos[black] & (1ULL << move_origination(move))) { make_move<black>(move); }
+    else { make_move<white>(move); }
+}
+
+template<int color> void takeback_move(int move) {
+    PROFILE(PROFILE_TAKEBACK_MOVE);
+    const int own = ((color == white) ? wP : bP);
+    int origination = move_origination(move); int destination = move_destination(move);
+    int flag = move_flag(move);
+    int captured = pop_state().captured;
+
+    if (flag == FLAG_SHORT_CASTLE) {
+        if (color == white) { move_piece_back(wK, 1, 3); move_piece_back(wR, 2, 0); }
+        else { move_piece_back(bK, 57, 59); move_piece_back(bR, 58, 56); }
+    }
+    else if (flag == FLAG_LONG_CASTLE) {
+        if (color == white) { move_piece_back(wK, 5, 3); move_piece_back(wR, 4, 7); }
+        else { move_piece_back(bK, 61, 59); move_piece_back(bR, 60, 63); }
+    }
+    else if (flag == FLAG_EN_PASSANT) {
+        move_piece_back(own+wP, destination, origination);
+        put_back_piece(captured, ((color == white) ? (destination-8) : (destination+8)));
+    }
     else {
-        for (int i=0; i<13; i++) {
-            if (pos[i] & (1ULL << destination)) {
-                pos[i] ^= (1ULL << destination);
-                pos[i] |= (1ULL << origination);
+        if (flag & FLAG_PROMOTION) {
+            take_off_piece(own+promotion_piece(move), destination);
+            put_back_piece(own+wP, origination);
+        }
+        else {
+            for (int i=own; i<own+6; i++) {
+                if (pos[i] & (1ULL << destination)) {
+                    move_piece_back(i, destination, origination);
+                    break;
+                }
             }
         }
-        pos[capture_sequence[depth-1]] |= (1ULL << destination);
+        if (captured != empty) { put_back_piece(captured, destination); }
     }
     update_colors();
 }
 
+void takeback_move(int move) {
+    if (pos[black] & (1ULL << move_destination(move))) { takeback_move<black>(move); }
+    else { takeback_move<white>(move); }
+}
+
 /////////////////////////////////////////////////////////////////////////////////////
 // MOVE ORDER HEURISTICS
 /////////////////////////////////////////////////////////////////////////////////////
-void update_principle_variation(int color) {
-    uint64_t key = gen_zobrist_key(color);
-    int hash = gen_hash_index(key);
-    for (int n=0; n<iteration_depth; n++) {
-        // retrieve best move from transposition table
-        int best_move = HASH_TABLE[hash][p_best];
-        principal_variation[n] = best_move;
-        int origination = (best_move >> 6);
-        int destination = (best_move & 63);
-        // find zobrist key for next position
-        make_move(origination, destination, n+1);
-        color = opp(color);
-        key = gen_zobrist_key(color);
-        hash = gen_hash_index(key);
-    }
-    // undo board manipulation
-    for (int n=iteration_depth; n>0; n--) {
-        int origination = (principal_variation[n-1] >> 6);
-        int destination = (principal_variation[n-1] & 63);
-        takeback_move(origination, destination, n);
-    }
-}
-
 int mvv_lva(int move, int color) {
     // rank captures by most valuable victim, least valuable attacker
-    int origination = (move >> 6);
-    int destination = (move & 63);
+    int origination = move_origination(move);
+    int destination = move_destination(move);
     int eval = 0;
 
     return (material_value_at(destination) - material_value_at(origination));
 }
 
 int heuristic_eval(int move, int color, int depth) {
-    int origination = (move >> 6);
-    int destination = (move & 63);
+    int origination = move_origination(move);
+    int destination = move_destination(move);
     int eval = 0;
     // principal variation move
     if (move == principal_variation[iteration_depth - depth]) { eval += 30000; }
@@ -878,77 +1781,161 @@ int heuristic_eval(int move, int color, int depth) {
     // transposition table move
     //int key = gen_zobrist_key(color);
     //int hash = gen_hash_index(key);
-    //if ((key == HASH_TABLE[hash][p_key]) && (move == HASH_TABLE[hash][p_best])) { eval += 10000; }
+    //if ((key == HASH_TABLE[hash].key) && (move == HASH_TABLE[hash].best)) { eval += 10000; }
 
     // mvv-lva
     if (pos[opp(color)] & (1ULL << destination)) { eval += (material_value_at(destination) - material_value_at(origination)); }
 
     // controlling center
-    if ((1ULL << (move & 63)) & MIDDLE) { eval += MIDDLE_BONUS; }
-    if ((1ULL << (move & 63)) & AUXMID) { eval += AUXMID_BONUS; }
-    if ((1ULL << (move & 63)) & EDGE) { eval -= EDGE_PENALTY; }
+    if ((1ULL << destination) & MIDDLE) { eval += MIDDLE_BONUS; }
+    if ((1ULL << destination) & AUXMID) { eval += AUXMID_BONUS; }
+    if ((1ULL << destination) & EDGE) { eval -= EDGE_PENALTY; }
 
     // disincentivize moving queen and king
     if (material_value_at(origination) < R_VAL) { eval += (material_value_at(origination) / 100); }
-    eval += layer_previous_evals[iteration_depth-depth][move];
+    eval += layer_previous_evals[iteration_depth-depth][move & 4095];
+
+    // underpromotions share the queen promotion's previous eval, so they go after it
+    if (move_is_promotion(move)) { eval -= (VAL[wQ] - VAL[promotion_piece(move)]); }
 
     return eval;
 }
 
+#ifdef SEARCH_STATS
+int ordering_index_bucket(int index) {
+    if (index < 4) { return index; }
+    int bucket = 2;
+    while ((index >>= 1) > 1) { bucket++; }
+    return std::min(bucket + 1, ORDERING_INDEX_BUCKETS-1);
+}
+
+int ordering_source(int move, int color, int depth, int previous_eval) {
+    // the fixed bonuses are checked in the order of their size, then whichever of the
+    // mvv-lva and previous iteration terms added more
+    if (move == principal_variation[iteration_depth - depth]) { return ORDER_PV; }
+    if (move == layer_best_moves[depth-1]) { return ORDER_PREVIOUS_BEST; }
+    if (move == layer_killer_moves[depth]) { return ORDER_KILLER; }
+    if (pos[opp(color)] & (1ULL << move_destination(move))) {
+        int gain = (material_value_at(move_destination(move)) - material_value_at(move_origination(move)));
+        if (gain >= previous_eval) { return ORDER_CAPTURE; }
+    }
+    if (previous_eval != 0) { return ORDER_PREVIOUS_EVAL; }
+    return ORDER_POSITIONAL;
+}
+
+void record_cutoff(int move, int index, int color, int depth, int previous_eval) {
+    search_stats.cutoff_index_sum[depth] += index;
+    search_stats.cutoff_index[depth][ordering_index_bucket(index)]++;
+    search_stats.cutoff_source[depth][ordering_source(move, color, depth, previous_eval)]++;
+}
+#endif
+
 /////////////////////////////////////////////////////////////////////////////////////
 // MOVES LIST
 // functions for generating and ordering the list of possible moves at a given depth
 /////////////////////////////////////////////////////////////////////////////////////
-int generate_color_moves_list(int color, int depth) {
+template<int color> int add_piece_moves(int origination, uint64_t destinations, int depth, int counter) {
+    // flag every destination of the piece on origination and append it to the list
+    const int own = ((color == white) ? wP : bP);
+    bool pawn = (pos[own+wP] & (1ULL << origination));
+    bool king = (pos[own+wK] & (1ULL << origination));
+    while (destinations) {
+        int destination = bit_scan_left(destinations);
+        destinations &= (destinations - 1);
+        int flag = ((pos[opp(color)] & (1ULL << destination)) ? FLAG_CAPTURE : FLAG_QUIET);
+        if (pawn && ((RANK_1 | RANK_8) & (1ULL << destination))) {
+            // queen first, underpromotions after
+            int promotion = ((flag == FLAG_CAPTURE) ? FLAG_PROMOTION_CAPTURE : FLAG_PROMOTION);
+            for (int piece=wQ; piece>=wN; piece--) {
+                moves_list[depth-1][counter++] = encode_move(origination, destination, promotion + (piece - 1));
+            }
+            continue;
+        }
+        if (pawn && (std::abs(destination - origination) == 16)) { flag = FLAG_DOUBLE_PUSH; }
+        else if (pawn && (flag == FLAG_QUIET) && ((destination - origination) % 8 != 0)
+                 && (((color == white) ? en_passant_b : en_passant_w) & (1ULL << destination))) { flag = FLAG_EN_PASSANT; }
+        else if (king && (std::abs(destination - origination) == 2)) {
+            flag = ((destination < origination) ? FLAG_SHORT_CASTLE : FLAG_LONG_CASTLE);
+        }
+        moves_list[depth-1][counter++] = encode_move(origination, destination, flag);
+    }
+    return counter;
+}
+
+template<int color> int generate_color_moves_list(int depth) {
+    PROFILE(PROFILE_MOVE_GENERATION);
     uint64_t moves = 0;
     int counter = 0;
     // scanning board in reverse gives slightly better move ordering since kingside is on right
     for (int i=63; i>=0; i--) {
         if (pos[color] & (1ULL << i)) {
-            moves = generate_piece_moves(i);
+            moves = generate_piece_moves<color>(i);
             moves &= ~pos[color];
-
-            // locate destinations
-            for (int j=0; j<64; j++) {
-                if (moves & (1ULL << j)) {
-                    int move = ((i << 6) | j);
-                    moves_list[depth-1][counter] = move;
-                    counter++;
-                }
-            }
+            counter = add_piece_moves<color>(i, moves, depth, counter);
         }
     }
     return counter;
 }
 
+int generate_color_moves_list(int color, int depth) {
+    if (color == white) { return generate_color_moves_list<white>(depth); }
+    else { return generate_color_moves_list<black>(depth); }
+}
+
 void score_list(int num_moves, int color, int depth) {
     for (int i=0; i<num_moves; i++) {
         values_list[depth-1][i] = heuristic_eval(moves_list[depth-1][i], color, depth);
     }
 }
 
-int generate_color_attks_list(int color, int depth) {
+template<int color> int generate_color_attks_list(int depth) {
     uint64_t attks = 0;
     int counter = 0;
     // scanning board in reverse gives slightly better move ordering since kingside is on right
     for (int i=63; i>=0; i--) {
         if (pos[color] & (1ULL << i)) {
-            attks = generate_piece_moves(i);
+            attks = generate_piece_moves<color>(i);
             attks &= pos[opp(color)];
 
-            // locate destinations
-            for (int j=0; j<64; j++) {
-                if (attks & (1ULL << j)) {
-                    int move = ((i << 6) | j);
-                    moves_list[depth-1][counter] = move;
-                    counter++;
-                }
+            // only queen promotions are worth a capture search
+            bool pawn = (pos[(color == white) ? wP : bP] & (1ULL << i));
+            while (attks) {
+                int j = bit_scan_left(attks);
+                attks &= (attks - 1);
+                int flag = ((pawn && ((RANK_1 | RANK_8) & (1ULL << j))) ? (FLAG_PROMOTION_CAPTURE + (wQ - 1)) : FLAG_CAPTURE);
+                moves_list[depth-1][counter++] = encode_move(i, j, flag);
             }
         }
     }
     return counter;
 }
 
+int generate_color_attks_list(int color, int depth) {
+    if (color == white) { return generate_color_attks_list<white>(depth); }
+    else { return generate_color_attks_list<black>(depth); }
+}
+
+int find_move(int color, int origination, int destination, int promotion, int depth) {
+    // the generated move between two squares (promoting to the white piece ID promotion,
+    // a queen when it is 0), so moves from outside the search get their flags
+    int num_moves = generate_color_moves_list(color, depth);
+    for (int i=0; i<num_moves; i++) {
+        int move = moves_list[depth-1][i];
+        if ((move_origination(move) != origination) || (move_destination(move) != destination)) { continue; }
+        if (move_is_promotion(move) && (promotion_piece(move) != (promotion ? promotion : wQ))) { continue; }
+        return move;
+    }
+    return 0;
+}
+
+void update_principle_variation() {
+    // the line the last root search left in the triangular table, ending early where
+    // the search stopped at a transposition
+    for (int n=0; n<MAX_DEPTH; n++) {
+        principal_variation[n] = ((n < pv_length[0]) ? pv_table[0][n] : 0);
+    }
+}
+
 void score_captures(int num_moves, int color, int depth) {
     for (int i=0; i<num_moves; i++) {
         values_list[depth-1][i] = mvv_lva(moves_list[depth-1][i], color);
@@ -976,23 +1963,131 @@ int get_next_best_move(int move_num, int num_moves, int depth) {
     return buffer;
 }
 
+/////////////////////////////////////////////////////////////////////////////////////
+// PAWN STRUCTURE
+// passed, doubled, isolated and backward pawns are found for all pawns at once by
+// smearing the pawn bitboards along their files (fills) and onto the neighbouring
+// files (attack spans).  The pawns change much less often than the other pieces, so
+// the result is kept in a pawn hash table under the zobrist key of the pawns alone.
+/////////////////////////////////////////////////////////////////////////////////////
+struct PawnEntry {
+    std::atomic<uint64_t> check; // key xor data, so a half written entry never matches
+    std::atomic<uint64_t> data;  // structure score and passed pawn bonus
+};
+PawnEntry PAWN_HASH[PAWN_HASH_LENGTH];
+thread_local int pawn_probes = 0; thread_local int pawn_hits = 0;
+
+uint64_t north_fill(uint64_t bits) {
+    bits |= (bits << 8); bits |= (bits << 16); bits |= (bits << 32);
+    return bits;
+}
+
+uint64_t south_fill(uint64_t bits) {
+    bits |= (bits >> 8); bits |= (bits >> 16); bits |= (bits >> 32);
+    return bits;
+}
+
+uint64_t neighbor_files(uint64_t bits) {
+    // shift one file towards a and one towards h without wrapping around the board
+    return (((bits << 1) & ~FILE_H) | ((bits >> 1) & ~FILE_A));
+}
+
+int passed_pawn_bonus(uint64_t passed, bool white_pawns) {
+    int bonus = 0;
+    while (passed) {
+        int i = bit_scan_left(passed);
+        passed &= (passed - 1);
+        int rank = (white_pawns) ? (i / 8) : (7 - i / 8);
+        bonus += PASSED_BONUS[rank];
+    }
+    return bonus;
+}
+
+void evaluate_pawns(int& score, int& passed_score) {
+    uint64_t white_pawns = pos[wP]; uint64_t black_pawns = pos[bP];
+
+    // front spans and attack spans
+    uint64_t white_front = north_fill(white_pawns << 8);
+    uint64_t black_front = south_fill(black_pawns >> 8);
+    uint64_t white_attack_span = north_fill(neighbor_files(white_pawns));
+    uint64_t black_attack_span = south_fill(neighbor_files(black_pawns));
+    uint64_t white_attacks = (neighbor_files(white_pawns) << 8);
+    uint64_t black_attacks = (neighbor_files(black_pawns) >> 8);
+
+    // passed pawns have no enemy pawn ahead of them on their own or a neighboring file
+    uint64_t white_passed = (white_pawns & ~(black_front | neighbor_files(black_front)));
+    uint64_t black_passed = (black_pawns & ~(white_front | neighbor_files(white_front)));
+
+    // doubled pawns have a friendly pawn behind them
+    uint64_t white_doubled = (white_pawns & north_fill(white_pawns << 8));
+    uint64_t black_doubled = (black_pawns & south_fill(black_pawns >> 8));
+
+    // isolated pawns have no friendly pawns on the neighboring files
+    uint64_t white_isolated = (white_pawns & ~neighbor_files(north_fill(white_pawns) | south_fill(white_pawns)));
+    uint64_t black_isolated = (black_pawns & ~neighbor_files(north_fill(black_pawns) | south_fill(black_pawns)));
+
+    // backward pawns can not be supported and their stop square is controlled by a pawn
+    uint64_t white_backward = (((white_pawns << 8) & black_attacks & ~white_attack_span) >> 8);
+    uint64_t black_backward = (((black_pawns >> 8) & white_attacks & ~black_attack_span) << 8);
+
+    score = -DOUBLED_PENALTY * (count(white_doubled) - count(black_doubled))
+            - ISOLATED_PENALTY * (count(white_isolated) - count(black_isolated))
+            - BACKWARD_PENALTY * (count(white_backward) - count(black_backward));
+    passed_score = (passed_pawn_bonus(white_passed, true) - passed_pawn_bonus(black_passed, false));
+}
+
+int pawn_structure_evaluation(int phase) {
+    PawnEntry& entry = PAWN_HASH[pawn_key & (PAWN_HASH_LENGTH - 1)];
+    uint64_t data = entry.data.load(std::memory_order_relaxed);
+    uint64_t check = entry.check.load(std::memory_order_relaxed);
+    int score; int passed_score;
+    pawn_probes++;
+    if ((check ^ data) == pawn_key) {
+        pawn_hits++;
+        score = (int32_t)(data >> 32);
+        passed_score = (int32_t)(data & 0xFFFFFFFF);
+    }
+    else {
+        evaluate_pawns(score, passed_score);
+        data = (((uint64_t)(uint32_t)score << 32) | (uint32_t)passed_score);
+        entry.data.store(data, std::memory_order_relaxed);
+        entry.check.store((pawn_key ^ data), std::memory_order_relaxed);
+    }
+    // passed pawns grow more valuable as the pieces come off
+    return (score + (passed_score * (48 - phase)) / 24);
+}
+
+void clear_pawn_hash() {
+    for (int i=0; i<PAWN_HASH_LENGTH; i++) {
+        PAWN_HASH[i].check.store(0, std::memory_order_relaxed);
+        PAWN_HASH[i].data.store(0, std::memory_order_relaxed);
+    }
+}
+
 /////////////////////////////////////////////////////////////////////////////////////
 // BOARD EVALUATION
 // the engine looks at a combination of material and positional advantages and also
 // orders each move with heuristic weight to improve alpha-beta cut off rates
 /////////////////////////////////////////////////////////////////////////////////////
-void generate_checks(int color) {
-    checks[color-white] = 0;
+template<int color> void generate_checks() {
+    uint64_t attacks = 0;
     for (int i=63; i>=0; i--) {
         if (pos[color] & (1ULL << i)) {
-            checks[color-white] |= generate_piece_attacks(i);
+            attacks |= generate_piece_attacks<color>(i);
         }
     }
+    checks[color-white] = attacks;
+}
+
+void generate_checks(int color) {
+    if (color == white) { generate_checks<white>(); }
+    else { generate_checks<black>(); }
 }
 
 void update_checks() {
-    generate_checks(white);
-    generate_checks(black);
+    PROFILE(PROFILE_UPDATE_CHECKS);
+    generate_checks<white>();
+    generate_checks<black>();
 }
 
 bool game_is_won_by_checkmate() {
@@ -1001,11 +2096,10 @@ bool game_is_won_by_checkmate() {
         int num_moves = generate_color_moves_list(white, 2*MAX_DEPTH+1);
         bool in_checkmate = true;
         for (int i=0; i<num_moves; i++) {
-            int origination = (moves_list[2*MAX_DEPTH][i] >> 6);
-            int destination = (moves_list[2*MAX_DEPTH][i] & 63);
-            make_move(origination, destination, 2*MAX_DEPTH+1);
+            int move = moves_list[2*MAX_DEPTH][i];
+            make_move(move);
             generate_checks(black);
-            takeback_move(origination, destination, 2*MAX_DEPTH+1);
+            takeback_move(move);
             if ((pos[wK] & checks[1]) == 0) {
                 in_checkmate = false;
                 break;
@@ -1017,11 +2111,10 @@ bool game_is_won_by_checkmate() {
         int num_moves = generate_color_moves_list(black, 2*MAX_DEPTH+1);
         bool in_checkmate = true;
         for (int i=0; i<num_moves; i++) {
-            int origination = (moves_list[2*MAX_DEPTH][i] >> 6);
-            int destination = (moves_list[2*MAX_DEPTH][i] & 63);
-            make_move(origination, destination, 2*MAX_DEPTH+1);
+            int move = moves_list[2*MAX_DEPTH][i];
+            make_move(move);
             generate_checks(white);
-            takeback_move(origination, destination, 2*MAX_DEPTH+1);
+            takeback_move(move);
             if (pos[wK] & ~checks[0]) {
                 in_checkmate = false;
                 break;
@@ -1033,37 +2126,12 @@ bool game_is_won_by_checkmate() {
 }
 
 bool game_is_drawn_by_insufficient_material() {
-    // K vs K
-    if ((pos[white] == pos[wK]) && (pos[black] == pos[bK])) { return true; }
-    // K+N vs K
-    else if ((pos[white] == (pos[wK] | pos[wN])) && (pos[black] == pos[bK]) 
-            && (count(pos[white]) == 2) && (count(pos[black]) == 1)) { return true; }
-    // K vs K+N
-    else if ((pos[white] == pos[wK]) && (pos[black] == (pos[bK] | pos[bN]))
-            && (count(pos[white]) == 1) && (count(pos[black]) == 2)) { return true; }
-    // K+B vs K
-    else if ((pos[white] == (pos[wK] | pos[wB])) && (pos[black] == pos[bK])
-            && (count(pos[white]) == 2) && (count(pos[black]) == 1)) { return true; }
-    // K vs K+B
-    else if ((pos[white] == pos[wK]) && (pos[black] == (pos[bK] | pos[bB]))
-            && (count(pos[white]) == 1) && (count(pos[black]) == 2)) { return true; }
-    // K+N vs K+B
-    else if ((pos[white] == (pos[wK] | pos[wN])) && (pos[black] == (pos[bK] | pos[bB]))
-            && (count(pos[white]) == 2) && (count(pos[black]) == 2)) { return true; }
-    // K+B vs K+N
-    else if ((pos[white] == (pos[wK] | pos[wB])) && (pos[black] == (pos[bK] | pos[bN]))
-            && (count(pos[white]) == 2) && (count(pos[black]) == 2)) { return true; }
-    // K+B vs K+B
-    else if ((pos[white] == (pos[wK] | pos[wB])) && (pos[black] == (pos[bK] | pos[bB]))
-            && (count(pos[white]) == 2) && (count(pos[black]) == 2)) { return true; }
-    // K+N vs K+N
-    else if ((pos[white] == (pos[wK] | pos[wN])) && (pos[black] == (pos[bK] | pos[bN]))
-            && (count(pos[white]) == 2) && (count(pos[black]) == 2)) { return true; }
-    // sufficient material
-    else { return false; }
+    return material_entry().draw;
 }
 
-int node_evaluation() {
+int piece_evaluation(const MaterialEntry& material) {
+    // material, piece squares and mobility: everything but the pawn structure and scaling
+    PROFILE(PROFILE_NODE_EVALUATION);
     int evaluation = 0;
     for (int i=0; i<64; i++) {
         if (pos[wP] & (1ULL << i)) { evaluation += (PST[wP][63-i] + VAL[wP]); }
@@ -1072,7 +2140,7 @@ int node_evaluation() {
         else if (pos[wR] & (1ULL << i)) { evaluation += (PST[wR][63-i] + VAL[wR]); }
         else if (pos[wQ] & (1ULL << i)) { evaluation += (PST[wQ][63-i] + VAL[wQ]); }
         else if (pos[wK] & (1ULL << i)) { 
-            if (count(pos[black] ^ (pos[bK] | pos[bP])) <= ENDGAME_CUTOFF) { evaluation += (PST[wK+1][63-i] + VAL[wK]); }
+            if (material.king_endgame[0]) { evaluation += (PST[wK+1][63-i] + VAL[wK]); }
             else { evaluation += (PST[wK][63-i] + VAL[wK]); }
         }
 
@@ -1082,7 +2150,7 @@ int node_evaluation() {
         else if (pos[bR] & (1ULL << i)) { evaluation -= (PST[wR][63-black_pst_index(i)] + VAL[wR]); }
         else if (pos[bQ] & (1ULL << i)) { evaluation -= (PST[wQ][63-black_pst_index(i)] + VAL[wQ]); }
         else if (pos[bK] & (1ULL << i)) {
-            if (count(pos[white] ^ (pos[wK] | pos[wP])) <= ENDGAME_CUTOFF) { evaluation -= (PST[wK+1][black_pst_index(63-i)] + VAL[wK]); }
+            if (material.king_endgame[1]) { evaluation -= (PST[wK+1][black_pst_index(63-i)] + VAL[wK]); }
             else { evaluation -= (PST[wK][black_pst_index(63-i)] + VAL[wK]); }
         }
     }
@@ -1090,18 +2158,362 @@ int node_evaluation() {
     return evaluation;
 }
 
+int finish_evaluation(int evaluation, const MaterialEntry& material) {
+    // add the pawn structure to the piece evaluation, then trust an advantage less when
+    // the material is hard to win with
+    evaluation += pawn_structure_evaluation(material.phase);
+    if (evaluation > 0) { evaluation = (evaluation * material.scale[0]) / 64; }
+    else { evaluation = (evaluation * material.scale[1]) / 64; }
+    return evaluation;
+}
+
+int node_evaluation() {
+    const MaterialEntry& material = material_entry();
+    return finish_evaluation(piece_evaluation(material), material);
+}
+
+/////////////////////////////////////////////////////////////////////////////////////
+// EVALUATION CACHE
+// the same leaf is often reached through captures made in a different order, so the
+// evaluation of every position is remembered by the zobrist key of its pieces.  Each
+// slot is a single 64 bit word holding the top of the key and the score, which lets
+// threads share the cache without locks and never read half of an entry.  The pawn
+// structure is left out of the cached score and looked up in the pawn hash every time,
+// so that table sees every evaluation instead of only the new positions.
+/////////////////////////////////////////////////////////////////////////////////////
+std::atomic<uint64_t> EVAL_CACHE[EVAL_CACHE_LENGTH];
+const uint64_t EVAL_KEY_MASK = 0xFFFFFFFFFF000000ULL; // top 40 bits of the key
+const uint64_t EVAL_SCORE_MASK = 0xFFFFFF;             // bottom 24 bits hold the score
+const int EVAL_SCORE_OFFSET = (1 << 23);
+thread_local int eval_probes = 0; thread_local int eval_hits = 0;
+
+int cached_evaluation() {
+    std::atomic<uint64_t>& slot = EVAL_CACHE[piece_key & (EVAL_CACHE_LENGTH - 1)];
+    uint64_t entry = slot.load(std::memory_order_relaxed);
+    const MaterialEntry& material = material_entry();
+    int evaluation;
+    eval_probes++;
+    if ((entry & EVAL_KEY_MASK) == (piece_key & EVAL_KEY_MASK)) {
+        eval_hits++;
+        evaluation = ((int)(entry & EVAL_SCORE_MASK) - EVAL_SCORE_OFFSET);
+    }
+    else {
+        evaluation = (nnue_loaded ? nnue_evaluation() : piece_evaluation(material));
+        slot.store(((piece_key & EVAL_KEY_MASK) | (uint64_t)(evaluation + EVAL_SCORE_OFFSET)), std::memory_order_relaxed);
+    }
+    // the network scores the whole position itself
+    return (nnue_loaded ? evaluation : finish_evaluation(evaluation, material));
+}
+
+void clear_eval_cache() {
+    // needed whenever the evaluation itself changes
+    for (int i=0; i<EVAL_CACHE_LENGTH; i++) { EVAL_CACHE[i].store(0, std::memory_order_relaxed); }
+}
+
+/////////////////////////////////////////////////////////////////////////////////////
+// ENDGAME BITBASES
+// every position of KPK, KRK, KQK and KBNK is solved once by retrograde analysis:
+// starting from the checkmates, each pass finds the positions that are one ply further
+// from mate, until nothing changes.  What is left is a draw.  Each table stores the
+// distance to mate in plies for the stronger side, which is always normalized to white.
+// Pawnless tables use the eight board symmetries to keep the strong king in the
+// a1-d1-d4 triangle.
+/////////////////////////////////////////////////////////////////////////////////////
+struct Bitbase {
+    int piece[2];          // extra pieces of the strong side, -1 if unused
+    int king_squares;      // 10 for pawnless tables, otherwise 64
+    std::vector<uint8_t> dtm; // 0 draw, 255 invalid, otherwise plies to mate + 1
+};
+
+Bitbase KQK = {{wQ, -1}, 10, {}};
+Bitbase KRK = {{wR, -1}, 10, {}};
+Bitbase KPK = {{wP, -1}, 64, {}};
+Bitbase KBNK = {{wB, wN}, 10, {}};
+const uint8_t BB_DRAW = 0;
+const uint8_t BB_INVALID = 255;
+int TRIANGLE[10] = { 7, 15, 14, 23, 22, 21, 31, 30, 29, 28 }; // a1, a2, b2, a3, b3, c3, a4, b4, c4, d4
+
+uint64_t king_attacks(int i) {
+    // gen_K_moves without castling, so it does not depend on the board
+    return ATTACK_TABLES.king[i];
+}
+
+uint64_t slider_attacks(int i, uint64_t occupied, int first_ray, int last_ray) {
+    // rays pointing to higher squares are blocked by their lowest piece and vice versa
+    uint64_t attacks = 0;
+    for (int ray=first_ray; ray<=last_ray; ray++) {
+        attacks |= RAYS[i][ray];
+        if (RAYS[i][ray] & occupied) {
+            bool rising = ((ray == nrt) || (ray == wst) || (ray == nrtest) || (ray == nrtwst));
+            int blocker_index;
+            if (rising) { blocker_index = bit_scan_left(RAYS[i][ray] & occupied); }
+            else { blocker_index = bit_scan_right(RAYS[i][ray] & occupied); }
+            attacks &= ~RAYS[blocker_index][ray];
+        }
+    }
+    return attacks;
+}
+
+uint64_t bitbase_piece_attacks(int piece, int i, uint64_t occupied) {
+    if (piece == wP) { return gen_wP_attks(i); }
+    else if (piece == wN) { return gen_N_moves(i); }
+    else if (piece == wB) { return slider_attacks(i, occupied, nrtest, sthwst); }
+    else if (piece == wR) { return slider_attacks(i, occupied, nrt, wst); }
+    else if (piece == wQ) { return slider_attacks(i, occupied, nrt, sthwst); }
+    else { return king_attacks(i); }
+}
+
+int bitbase_pieces(const Bitbase& bb) {
+    if (bb.piece[1] >= 0) { return 4; }
+    else { return 3; }
+}
+
+size_t bitbase_size(const Bitbase& bb) {
+    size_t size = 2 * bb.king_squares * 64 * 64;
+    if (bb.piece[1] >= 0) { size *= 64; }
+    return size;
+}
+
+size_t bitbase_index(const Bitbase& bb, int side, int sq[4]) {
+    // sq holds the strong king, weak king and extra pieces; side 0 is strong to move
+    int n = bitbase_pieces(bb);
+    int king = sq[0];
+    int t[4] = { sq[0], sq[1], sq[2], sq[3] };
+    if (bb.king_squares == 10) {
+        int file = 7 - (sq[0] % 8); int rank = sq[0] / 8;
+        bool flip_file = (file > 3); if (flip_file) { file = 7 - file; }
+        bool flip_rank = (rank > 3); if (flip_rank) { rank = 7 - rank; }
+        bool flip_diagonal = (file > rank);
+        for (int k=0; k<n; k++) {
+            int f = 7 - (t[k] % 8); int r = t[k] / 8;
+            if (flip_file) { f = 7 - f; }
+            if (flip_rank) { r = 7 - r; }
+            if (flip_diagonal) { int buffer = f; f = r; r = buffer; }
+            t[k] = 8*r + (7 - f);
+        }
+        file = 7 - (t[0] % 8); rank = t[0] / 8;
+        king = (rank*(rank+1))/2 + file;
+    }
+    size_t index = (side * bb.king_squares + king);
+    for (int k=1; k<n; k++) { index = (index*64 + t[k]); }
+    return index;
+}
+
+int bitbase_squares(const Bitbase& bb, size_t index, int sq[4]) {
+    // inverse of bitbase_index for canonical positions, returns the side to move
+    int n = bitbase_pieces(bb);
+    for (int k=n-1; k>0; k--) { sq[k] = (index % 64); index /= 64; }
+    int king = (index % bb.king_squares);
+    if (bb.king_squares == 10) { sq[0] = TRIANGLE[king]; }
+    else { sq[0] = king; }
+    return (index / bb.king_squares);
+}
+
+uint64_t strong_attacks(const Bitbase& bb, int sq[4], uint64_t occupied, int captured) {
+    uint64_t attacks = king_attacks(sq[0]);
+    for (int k=2; k<bitbase_pieces(bb); k++) {
+        if (k != captured) { attacks |= bitbase_piece_attacks(bb.piece[k-2], sq[k], occupied); }
+    }
+    return attacks;
+}
+
+bool bitbase_position_is_valid(const Bitbase& bb, int side, int sq[4]) {
+    int n = bitbase_pieces(bb);
+    uint64_t occupied = 0;
+    for (int k=0; k<n; k++) {
+        if (occupied & (1ULL << sq[k])) { return false; }
+        occupied |= (1ULL << sq[k]);
+    }
+    if (king_attacks(sq[0]) & (1ULL << sq[1])) { return false; }
+    if ((bb.piece[0] == wP) && ((RANK_1 | RANK_8) & (1ULL << sq[2]))) { return false; }
+    // the weak king can not be in check with the strong side to move
+    if ((side == 0) && (strong_attacks(bb, sq, occupied, -1) & (1ULL << sq[1]))) { return false; }
+    return true;
+}
+
+uint8_t weak_side_value(const Bitbase& bb, int sq[4], int ply) {
+    // the weak side is lost only if every king move runs into a position already won
+    int n = bitbase_pieces(bb);
+    uint64_t occupied = 0;
+    for (int k=0; k<n; k++) { occupied |= (1ULL << sq[k]); }
+    uint64_t without_king = (occupied ^ (1ULL << sq[1]));
+    int legal_moves = 0; uint8_t longest = 0;
+
+    uint64_t moves = king_attacks(sq[1]) & ~king_attacks(sq[0]) & ~(1ULL << sq[0]);
+    while (moves) {
+        int destination = bit_scan_left(moves);
+        moves &= (moves - 1);
+        int captured = -1;
+        for (int k=2; k<n; k++) { if (sq[k] == destination) { captured = k; } }
+        uint64_t attacked = strong_attacks(bb, sq, (without_king | (1ULL << destination)), captured);
+        if (attacked & (1ULL << destination)) { continue; }
+        // winning back a piece leaves too little material to mate
+        if (captured >= 0) { return BB_DRAW; }
+
+        int child[4] = { sq[0], destination, sq[2], sq[3] };
+        uint8_t value = bb.dtm[bitbase_index(bb, 0, child)];
+        if (value == BB_DRAW) { return BB_DRAW; }
+        longest = std::max(longest, value);
+        legal_moves++;
+    }
+
+    if (legal_moves == 0) {
+        bool in_check = (strong_attacks(bb, sq, occupied, -1) & (1ULL << sq[1]));
+        if (in_check && (ply == 0)) { return 1; }
+        return BB_DRAW;
+    }
+    if (longest == ply) { return (ply + 1); }
+    return BB_DRAW;
+}
+
+uint8_t strong_side_value(const Bitbase& bb, int sq[4], int ply) {
+    // the strong side wins if any move reaches a position lost for the weak side
+    int n = bitbase_pieces(bb);
+    uint64_t occupied = 0;
+    for (int k=0; k<n; k++) { occupied |= (1ULL << sq[k]); }
+
+    for (int k=0; k<n; k++) {
+        if (k == 1) { continue; }
+        int piece = wK;
+        if (k >= 2) { piece = bb.piece[k-2]; }
+        uint64_t moves;
+        if (piece == wP) {
+            moves = ((1ULL << sq[k]) << 8) & ~occupied;
+            if (moves && (RANK_2 & (1ULL << sq[k]))) { moves |= ((1ULL << sq[k]) << 16) & ~occupied; }
+        }
+        else if (piece == wK) { moves = king_attacks(sq[k]) & ~occupied & ~king_attacks(sq[1]); }
+        else { moves = bitbase_piece_attacks(piece, sq[k], occupied) & ~occupied; }
+
+        while (moves) {
+            int destination = bit_scan_left(moves);
+            moves &= (moves - 1);
+            int child[4] = { sq[0], sq[1], sq[2], sq[3] };
+            child[k] = destination;
+            uint8_t value;
+            if ((piece == wP) && (RANK_8 & (1ULL << destination))) {
+                // promotions continue in the queen or rook table
+                value = KQK.dtm[bitbase_index(KQK, 1, child)];
+                uint8_t rook_value = KRK.dtm[bitbase_index(KRK, 1, child)];
+                if ((value != ply) && (rook_value == ply)) { value = rook_value; }
+            }
+            else { value = bb.dtm[bitbase_index(bb, 1, child)]; }
+            if (value == ply) { return (ply + 1); }
+        }
+    }
+    return BB_DRAW;
+}
+
+void generate_bitbase(Bitbase& bb) {
+    size_t size = bitbase_size(bb);
+    bb.dtm.assign(size, BB_DRAW);
+    int sq[4] = { 0, 0, 0, 0 };
+    for (size_t index=0; index<size; index++) {
+        int side = bitbase_squares(bb, index, sq);
+        if (!bitbase_position_is_valid(bb, side, sq)) { bb.dtm[index] = BB_INVALID; }
+    }
+
+    // weak side moves on even plies, strong side on odd plies
+    int unchanged = 0;
+    for (int ply=0; (ply < 254) && (unchanged < 2); ply++) {
+        int side = ((ply % 2 == 0) ? 1 : 0);
+        std::vector<size_t> solved;
+        // the side to move is the top of the index, so each side is one half of the table
+        for (size_t index=side*(size/2); index<(side+1)*(size/2); index++) {
+            if (bb.dtm[index] != BB_DRAW) { continue; }
+            bitbase_squares(bb, index, sq);
+            uint8_t value;
+            if (side == 1) { value = weak_side_value(bb, sq, ply); }
+            else { value = strong_side_value(bb, sq, ply); }
+            if (value != BB_DRAW) { solved.push_back(index); }
+        }
+        // values are written after the pass so every position in it sees the same table
+        for (size_t index : solved) { bb.dtm[index] = (ply + 1); }
+        if (solved.empty()) { unchanged++; }
+        else { unchanged = 0; }
+    }
+}
+
+Bitbase* BITBASES[4] = { &KQK, &KRK, &KPK, &KBNK }; // file order, KPK needs KQK and KRK
+
+bool load_bitbases(const char* path) {
+    FILE* file = fopen(path, "rb");
+    if (file == nullptr) { return false; }
+    bool loaded = true;
+    for (Bitbase* bb : BITBASES) {
+        bb->dtm.resize(bitbase_size(*bb));
+        if (fread(bb->dtm.data(), 1, bb->dtm.size(), file) != bb->dtm.size()) { loaded = false; }
+    }
+    fclose(file);
+    if (!loaded) { for (Bitbase* bb : BITBASES) { bb->dtm.clear(); } }
+    return loaded;
+}
+
+void init_bitbases() {
+    if (load_bitbases(BITBASE_FILE)) { return; }
+    // without the file only the three piece endings are solved, KBNK takes too long
+    generate_bitbase(KQK);
+    generate_bitbase(KRK);
+    generate_bitbase(KPK);
+}
+
+bool probe_bitbases(int color, int& score) {
+    // the material table knows which bitbase, if any, solves this material
+    const MaterialEntry& material = material_entry();
+    if (material.bitbase == 0) { return false; }
+    Bitbase* bb = BITBASES[material.bitbase - 1];
+    if (bb->dtm.empty()) { return false; }
+    int strong = material.strong;
+    int offset = ((strong == white) ? 0 : bP);
+
+    // black is made the strong side by mirroring the board
+    int sq[4] = { bit_scan_left(pos[wK+offset]), bit_scan_left(pos[bK-offset]), 0, 0 };
+    sq[2] = bit_scan_left(pos[bb->piece[0] + offset]);
+    if (bb->piece[1] >= 0) { sq[3] = bit_scan_left(pos[bb->piece[1] + offset]); }
+    if (strong == black) { for (int k=0; k<4; k++) { sq[k] ^= 56; } }
+    int side = ((color == strong) ? 0 : 1);
+
+    uint8_t value = bb->dtm[bitbase_index(*bb, side, sq)];
+    if (value == BB_INVALID) { return false; }
+    if (value == BB_DRAW) {
+        if (color == white) { score = -DRAW_PENALTY; }
+        else { score = DRAW_PENALTY; }
+    }
+    else {
+        score = BITBASE_WIN - (value - 1);
+        if (side == 1) { score = -score; }
+    }
+    return true;
+}
+
+int write_bitbases() {
+    auto start = std::chrono::high_resolution_clock::now();
+    FILE* file = fopen(BITBASE_FILE, "wb");
+    if (file == nullptr) { std::cout << "CANNOT WRITE " << BITBASE_FILE << std::endl; return 1; }
+    for (Bitbase* bb : BITBASES) {
+        generate_bitbase(*bb);
+        fwrite(bb->dtm.data(), 1, bb->dtm.size(), file);
+    }
+    fclose(file);
+    auto end = std::chrono::high_resolution_clock::now();
+    auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(end - start);
+    std::cout << "bitbases written to " << BITBASE_FILE << " in " << duration.count() << " ms" << std::endl;
+    return 0;
+}
+
 /////////////////////////////////////////////////////////////////////////////////////
 // MOVE SEARCH
 // the engine itself - a core negamax implementation of the minimax algorithm with 
 // alpha-beta pruning.  Iterative deepening, a variety of move ordering heuristics,
 // and a transposition table are used to improve alpha-beta cut off rates.
 /////////////////////////////////////////////////////////////////////////////////////
-int quiescence_search(int color, int depth, int alpha, int beta) {
-    q_nodes++;
-    max_quiescence_search_depth = std::max(max_quiescence_search_depth, depth);
-    int num_moves = generate_color_attks_list(color, iteration_depth+depth+1);
-    int static_eval = node_evaluation();
+template<int color> int quiescence_search(int depth, int alpha, int beta, int* entry_eval = nullptr) {
+    // entry_eval receives the static evaluation of the position it was called on
+    search_stats.quiescence_nodes++;
+    search_stats.quiescence_depth = std::max(search_stats.quiescence_depth, depth);
+    int num_moves = generate_color_attks_list<color>(iteration_depth+depth+1);
+    int static_eval = cached_evaluation();
     if (color == black) { static_eval *= -1; }
+    if (entry_eval) { *entry_eval = static_eval; }
 
     // standing eval cut off
     if (static_eval >= beta) {
@@ -1117,18 +2529,17 @@ int quiescence_search(int color, int depth, int alpha, int beta) {
 
     // evade checks only at surface depth
     else if ((depth == 0) && (pos[wK] & checks[1] || (pos[bK] & checks[0]))) {
-        int num_moves = generate_color_moves_list(color, iteration_depth+depth+1);
+        int num_moves = generate_color_moves_list<color>(iteration_depth+depth+1);
         for (int i=0; i<num_moves; i++) {
-            int origination = (moves_list[iteration_depth+depth][i] >> 6);
-            int destination = (moves_list[iteration_depth+depth][i] & 63);
-            make_move(origination, destination, iteration_depth+depth+1);
+            int move = moves_list[iteration_depth+depth][i];
+            make_move<color>(move);
             update_checks();
             if ((pos[wK] & checks[1]) || (pos[bK] & checks[0])) { 
-                takeback_move(origination, destination, iteration_depth+depth+1);
+                takeback_move<color>(move);
             }
             else {
-                eval = -quiescence_search(opp(color), depth+1, -beta, -alpha);
-                takeback_move(origination, destination, iteration_depth+depth+1);
+                eval = -quiescence_search<opp(color)>(depth+1, -beta, -alpha);
+                takeback_move<color>(move);
 
                 best_eval = std::max(eval, best_eval);
                 alpha = std::max(alpha, best_eval);
@@ -1140,11 +2551,10 @@ int quiescence_search(int color, int depth, int alpha, int beta) {
         score_captures(num_moves, color, iteration_depth+depth+1);
         for (int i=0; i<num_moves; i++) {
             int move = get_next_best_move(i, num_moves, iteration_depth+depth+1);
-            int origination = (move >> 6); int destination = (move & 63);
-            make_move(origination, destination, iteration_depth+depth+1);
+            make_move<color>(move);
             update_checks();
-            eval = -quiescence_search(opp(color), depth+1, -beta, -alpha);
-            takeback_move(origination, destination, iteration_depth+depth+1);
+            eval = -quiescence_search<opp(color)>(depth+1, -beta, -alpha);
+            takeback_move<color>(move);
 
             best_eval = std::max(eval, best_eval);
             alpha = std::max(alpha, best_eval);
@@ -1155,16 +2565,43 @@ int quiescence_search(int color, int depth, int alpha, int beta) {
     return best_eval;
 }
 
-int minimax(int color, int depth, int terminal_depth, int alpha, int beta) {
+bool root_move_excluded(int move) {
+    for (int i=0; i<root_excluded; i++) {
+        if (root_exclusions[i] == move) { return true; }
+    }
+    return false;
+}
+
+template<int color, bool root> int minimax(int depth, int terminal_depth, int alpha, int beta) {
+    // the line below this node is empty until one of its moves becomes the best
+    int ply = iteration_depth - depth;
+    pv_length[ply] = ply;
+
+    if (iteration_node_limit && ((search_stats.minimax_nodes + search_stats.quiescence_nodes) >= iteration_node_limit)) {
+        search_aborted = true;
+    }
+    if (search_aborted) { return 0; }
+
+    // solved endgames cut off the whole subtree (the root still has to pick a move)
+    int bitbase_score;
+    if (!root && probe_bitbases(color, bitbase_score)) {
+        STATS(search_stats.bitbase_hits++);
+        return bitbase_score;
+    }
+
     if (depth == terminal_depth) {
+        STATS(search_stats.leaf_nodes++);
         if (pos[opp(color)] & checks[color-white]) {
-            int eval = quiescence_search(color, 0, alpha, beta);
+            int static_eval;
+            int eval = quiescence_search<color>(0, alpha, beta, &static_eval);
             // bc quiescence forces captures, only accept evals that indicate instability
             if (std::abs(eval) > STABILITY_WINDOW) { return eval; }
+            // quiescence's takebacks leave the check maps stale, so its entry eval is used
+            return static_eval;
         }
         // node eval is oriented toward white
-        if (color == white) { return node_evaluation(); }
-        else { return -node_evaluation(); }
+        if (color == white) { return cached_evaluation(); }
+        else { return -cached_evaluation(); }
     }
 
     // king capture
@@ -1176,17 +2613,32 @@ int minimax(int color, int depth, int terminal_depth, int alpha, int beta) {
         else { return DRAW_PENALTY; }
     }
 
-    int best_move; int best_eval;
+    int best_move = 0; int best_eval;
     uint64_t orig_pos_key = gen_zobrist_key(color);
     int orig_pos_hash = gen_hash_index(orig_pos_key);
+    STATS(search_stats.tt_probes++);
+    HashEntry stored;
+    bool hash_hit;
+    {
+        PROFILE(PROFILE_TT_PROBE);
+        hash_hit = read_hash_entry(orig_pos_hash, orig_pos_key, stored);
+        STATS(if (hash_hit) { search_stats.tt_hits++; })
+        hash_hit = (hash_hit && (stored.depth >= depth));
+        // a bound only settles the node when it falls outside the window, and the root
+        // takes its move from an exact score of this very depth or not at all
+        if (root) { hash_hit = (hash_hit && (stored.bound == HASH_EXACT) && (stored.depth == depth)); }
+        else if (stored.bound == HASH_LOWER) { hash_hit = (hash_hit && (-stored.eval <= alpha)); }
+        else if (stored.bound == HASH_UPPER) { hash_hit = (hash_hit && (-stored.eval >= beta)); }
+    }
 
     // if position has already been searched to the same depth or better, use that evaluation
-    if ((HASH_TABLE[orig_pos_hash][p_key] == orig_pos_key) && (HASH_TABLE[orig_pos_hash][p_depth] >= depth) && (depth > 1)) { 
+    // (not in a multipv search for the extra lines, which leaves the table alone)
+    if (hash_hit && (depth > 1) && !root_excluded) { 
         // best move only listed if depth > 1
         // depth should be at least one greater than current depth bc entries are stored at move_pos_key, not orig_pos_key, which is one depth higher
-        hash_entries++;
-        best_move = HASH_TABLE[orig_pos_hash][p_best];
-        best_eval = HASH_TABLE[orig_pos_hash][p_eval];
+        search_stats.tt_cutoffs++;
+        best_move = stored.best;
+        best_eval = -stored.eval; // stored by the parent, from the other side's point of view
     }
 
     // otherwise use minimax algorithm to explore move tree
@@ -1195,164 +2647,2597 @@ int minimax(int color, int depth, int terminal_depth, int alpha, int beta) {
         for (int i=0; i<depth; i++) { current_variation[iteration_depth - i] = 0; }
         int board_eval; best_eval = -2000000;
 
-        int num_moves = generate_color_moves_list(color, depth);
+        int num_moves = generate_color_moves_list<color>(depth);
         score_list(num_moves, color, depth);
+        STATS(search_stats.ordered_nodes[depth]++);
 
         for (int i=0; i<num_moves; i++) {
             // late move reduction
             int updated_terminal_depth = terminal_depth;
             if ((depth >= (terminal_depth + 3)) && (i > 1)) {
                 if (i > (num_moves * 0.70)) {
-                    late_move_reductions++;
+                    search_stats.reductions++;
                     updated_terminal_depth = terminal_depth + 2;
                 }
                 else if (i > (num_moves * 0.30)) {
-                    late_move_reductions++;
+                    search_stats.reductions++;
                     updated_terminal_depth = terminal_depth + 1;
                 }
             }
             // play next move
             int move = get_next_best_move(i, num_moves, depth);
+            if (root && root_excluded && root_move_excluded(move)) { continue; }
             current_variation[iteration_depth - depth] = move;
-            int origination = (move >> 6); int destination = (move & 63);
-            make_move(origination, destination, depth);
+            make_move<color>(move);
+            // the child's entry loads while the legality check runs
+            uint64_t move_pos_key = gen_zobrist_key(opp(color)); // the position arising after a move is the other player's turn
+            int move_pos_hash = gen_hash_index(move_pos_key);
+            prefetch_hash_entry(move_pos_hash);
 
             // skip move if it fails to prevent check
             update_checks();
             if (((color == white) && (pos[wK] & checks[1])) || 
                 ((color == black) && (pos[bK] & checks[0]))) {
-                takeback_move(origination, destination, depth);
+                takeback_move<color>(move);
             }
             
             else {
-                m_nodes++;
-                uint64_t move_pos_key = gen_zobrist_key(opp(color)); // the position arising after a move is the other player's turn
-                int move_pos_hash = gen_hash_index(move_pos_key);
+                search_stats.minimax_nodes++;
 
                 // go to next depth
-                board_eval = -minimax(opp(color), depth-1, updated_terminal_depth, -beta, -alpha);
-                takeback_move(origination, destination, depth);
-                layer_previous_evals[iteration_depth-depth][move] = board_eval;
+                board_eval = -minimax<opp(color), false>(depth-1, updated_terminal_depth, -beta, -alpha);
+                takeback_move<color>(move);
+                if (search_aborted) { return 0; }
+                STATS(int previous_eval = layer_previous_evals[iteration_depth-depth][move & 4095]);
+                // underpromotions would overwrite the queen promotion's eval, which
+                // orders it in the next iteration
+                if (!move_is_promotion(move) || (promotion_piece(move) == wQ)) {
+                    layer_previous_evals[iteration_depth-depth][move & 4095] = board_eval;
+                }
 
-                // store position attributes in hash table
-                HASH_TABLE[move_pos_hash][p_key] = move_pos_key;
-                HASH_TABLE[move_pos_hash][p_eval] = board_eval;
-                HASH_TABLE[move_pos_hash][p_depth] = depth-1; // the analysis for this move doesn't actually start until the next depth
+                // store position attributes in hash table.  A shallower result never replaces
+                // a deeper score of the same position, so the first iterations of a search keep
+                // what an earlier (or reloaded) search found
+                if (!root_excluded) {
+                    PROFILE(PROFILE_TT_STORE);
+                    HashEntry child;
+                    bool known = read_hash_entry(move_pos_hash, move_pos_key, child);
+                    // alpha is still the one the child was searched with
+                    uint8_t bound = ((board_eval <= alpha) ? HASH_UPPER : ((board_eval >= beta) ? HASH_LOWER : HASH_EXACT));
+                    // the child's best move, stored as its search ended, is kept.  The analysis
+                    // for this move doesn't actually start until the next depth
+                    HashEntry entry = { move_pos_key, board_eval, (int8_t)(depth-1), bound, (Move)(known ? child.best : 0) };
+                    if (!known || replaces_hash_entry(child, entry)) {
+                        write_hash_entry(move_pos_hash, entry);
+                        if ((depth-1) >= share_depth) { shared_entries.push_back(entry); }
+                    }
+                }
 
                 // update best move selection
                 if (board_eval > best_eval) {
                     best_eval = board_eval;
                     best_move = moves_list[depth-1][i];
+                    pv_table[ply][ply] = move;
+                    for (int n=ply+1; n<pv_length[ply+1]; n++) { pv_table[ply][n] = pv_table[ply+1][n]; }
+                    pv_length[ply] = std::max(pv_length[ply+1], ply+1);
                 }
 
                 // test for alpha-beta cut off
                 alpha = std::max(alpha, best_eval);
                 if (alpha >= beta) {
-                    cut_offs++;
+                    search_stats.cut_offs++;
+                    STATS(search_stats.fail_highs++);
+                    STATS(if (i == 0) { search_stats.first_move_fail_highs++; })
+                    STATS(record_cutoff(move, i, color, depth, previous_eval));
                     layer_killer_moves[depth] = moves_list[depth-1][i];
                     break;
                 }
             }
         }
         // use minimax findings to update best move in original position
-        HASH_TABLE[orig_pos_hash][p_best] = best_move;
+        PROFILE(PROFILE_TT_STORE);
+        if (!root_excluded) { store_hash_move(orig_pos_hash, orig_pos_key, best_move); }
     }
 
     layer_best_moves[depth-1] = best_move;
-    if (depth == iteration_depth) { return best_move; }
+    if (root) { root_eval = best_eval; return best_move; }
     else { return best_eval; }
 }
 
-int depth_search(int color, int depth_cap) {
+int minimax(int color, int depth, int terminal_depth, int alpha, int beta) {
+    // the root is the only node that returns a move instead of an eval
+    if (depth == iteration_depth) {
+        if (color == white) { return minimax<white, true>(depth, terminal_depth, alpha, beta); }
+        else { return minimax<black, true>(depth, terminal_depth, alpha, beta); }
+    }
+    if (color == white) { return minimax<white, false>(depth, terminal_depth, alpha, beta); }
+    else { return minimax<black, false>(depth, terminal_depth, alpha, beta); }
+}
+
+#ifdef SEARCH_STATS
+std::atomic<int> stats_threads(0);
+thread_local int stats_thread = stats_threads++;
+thread_local long previous_iteration_nodes = 0;
+std::mutex stats_file_lock;
+
+void record_move_ordering(int iteration) {
+    // one line (or one CSV row per remaining depth) per iteration, written with the stats
+    const SearchStats& stats = search_stats;
+    FILE* file = fopen(ORDERING_FILE, "a");
+    if (file == nullptr) { return; }
+    if (STATS_CSV && (ftell(file) == 0)) {
+        fprintf(file, "pid,thread,iteration,depth,nodes,cutoffs,average_index,"
+                      "index_0,index_1,index_2,index_3,index_4_7,index_8_15,index_16_31,index_32");
+        for (int s=0; s<ORDERING_SOURCES; s++) { fprintf(file, ",%s", ORDERING_SOURCE_NAMES[s]); }
+        fprintf(file, "\n");
+    }
+    if (!STATS_CSV) { fprintf(file, "{\"pid\":%d,\"thread\":%d,\"iteration\":%d,\"depths\":[", (int)getpid(), stats_thread, iteration); }
+    bool first = true;
+    for (int depth=iteration; depth>=1; depth--) {
+        if (stats.ordered_nodes[depth] == 0) { continue; }
+        long cutoffs = 0;
+        for (int s=0; s<ORDERING_SOURCES; s++) { cutoffs += stats.cutoff_source[depth][s]; }
+        double average_index = ((cutoffs > 0) ? ((double)stats.cutoff_index_sum[depth] / cutoffs) : 0);
+
+        if (STATS_CSV) {
+            fprintf(file, "%d,%d,%d,%d,%ld,%ld,%.3f", (int)getpid(), stats_thread, iteration, depth,
+                    stats.ordered_nodes[depth], cutoffs, average_index);
+            for (int b=0; b<ORDERING_INDEX_BUCKETS; b++) { fprintf(file, ",%ld", stats.cutoff_index[depth][b]); }
+            for (int s=0; s<ORDERING_SOURCES; s++) { fprintf(file, ",%ld", stats.cutoff_source[depth][s]); }
+            fprintf(file, "\n");
+        }
+        else {
+            fprintf(file, "%s{\"depth\":%d,\"nodes\":%ld,\"cutoffs\":%ld,\"average_index\":%.3f,\"index\":[",
+                    (first ? "" : ","), depth, stats.ordered_nodes[depth], cutoffs, average_index);
+            for (int b=0; b<ORDERING_INDEX_BUCKETS; b++) { fprintf(file, "%s%ld", (b ? "," : ""), stats.cutoff_index[depth][b]); }
+            fprintf(file, "],\"source\":{");
+            for (int s=0; s<ORDERING_SOURCES; s++) {
+                fprintf(file, "%s\"%s\":%ld", (s ? "," : ""), ORDERING_SOURCE_NAMES[s], stats.cutoff_source[depth][s]);
+            }
+            fprintf(file, "}}");
+        }
+        first = false;
+    }
+    if (!STATS_CSV) { fprintf(file, "]}\n"); }
+    fclose(file);
+}
+
+void record_search_stats(int depth, std::chrono::steady_clock::duration elapsed) {
+    // one line per iteration; the branching factor compares it with the iteration before
+    const SearchStats& stats = search_stats;
+    long nodes = (stats.minimax_nodes + stats.quiescence_nodes);
+    if (depth == 1) { previous_iteration_nodes = 0; }
+    double seconds = std::chrono::duration<double>(elapsed).count();
+    double branching = ((previous_iteration_nodes > 0) ? ((double)nodes / previous_iteration_nodes) : 0);
+    double first_move_rate = ((stats.fail_highs > 0) ? ((double)stats.first_move_fail_highs / stats.fail_highs) : 0);
+    previous_iteration_nodes = nodes;
+
+    std::lock_guard<std::mutex> guard(stats_file_lock);
+    FILE* file = fopen(STATS_FILE, "a");
+    if (file == nullptr) { return; }
+    if (STATS_CSV) {
+        if (ftell(file) == 0) {
+            fprintf(file, "pid,thread,depth,seldepth,nodes,minimax_nodes,quiescence_nodes,leaf_nodes,bitbase_hits,"
+                          "tt_probes,tt_hits,tt_cutoffs,cut_offs,reductions,first_move_fail_high,ebf,nps,time_ms\n");
+        }
+        fprintf(file, "%d,%d,%d,%d,%ld,%ld,%ld,%ld,%ld,%ld,%ld,%ld,%ld,%ld,%.4f,%.3f,%.0f,%.3f\n",
+                (int)getpid(), stats_thread, depth, depth + stats.quiescence_depth, nodes, stats.minimax_nodes,
+                stats.quiescence_nodes, stats.leaf_nodes, stats.bitbase_hits, stats.tt_probes, stats.tt_hits,
+                stats.tt_cutoffs, stats.cut_offs, stats.reductions, first_move_rate, branching,
+                nodes / std::max(seconds, 1e-9), 1000 * seconds);
+    }
+    else {
+        fprintf(file, "{\"pid\":%d,\"thread\":%d,\"depth\":%d,\"seldepth\":%d,\"nodes\":%ld,\"minimax_nodes\":%ld,"
+                      "\"quiescence_nodes\":%ld,\"leaf_nodes\":%ld,\"bitbase_hits\":%ld,\"tt_probes\":%ld,\"tt_hits\":%ld,"
+                      "\"tt_cutoffs\":%ld,\"cut_offs\":%ld,\"reductions\":%ld,\"first_move_fail_high\":%.4f,"
+                      "\"ebf\":%.3f,\"nps\":%.0f,\"time_ms\":%.3f}\n",
+                (int)getpid(), stats_thread, depth, depth + stats.quiescence_depth, nodes, stats.minimax_nodes,
+                stats.quiescence_nodes, stats.leaf_nodes, stats.bitbase_hits, stats.tt_probes, stats.tt_hits,
+                stats.tt_cutoffs, stats.cut_offs, stats.reductions, first_move_rate, branching,
+                nodes / std::max(seconds, 1e-9), 1000 * seconds);
+    }
+    fclose(file);
+    record_move_ordering(depth);
+}
+#endif
+
+#ifdef SEARCH_PROFILE
+uint64_t profile_overhead() {
+    // the cheapest back to back clock reading, taken off every timed call
+    uint64_t overhead = UINT64_MAX;
+    for (int i=0; i<1000; i++) {
+        uint64_t start = profile_clock();
+        overhead = std::min(overhead, profile_clock() - start);
+    }
+    return overhead;
+}
+
+void print_profile() {
+    // sections nest inside the search but not inside each other, so the shares add up to
+    // the time spent in those functions and the rest is minimax and quiescence themselves
+    uint64_t overhead = profile_overhead();
+    uint64_t search = profile_cycles[PROFILE_SEARCH];
+    printf("%-26s %12s %16s %12s %9s\n", "section", "calls", "cycles", "cycles/call", "% search");
+    for (int i=0; i<PROFILE_SECTIONS; i++) {
+        uint64_t correction = std::min(profile_cycles[i], overhead * profile_calls[i]);
+        uint64_t cycles = profile_cycles[i] - correction;
+        printf("%-26s %12ld %16llu %12.1f %8.2f%%\n", PROFILE_SECTION_NAMES[i], profile_calls[i],
+               (unsigned long long)cycles, (double)cycles / std::max(1L, profile_calls[i]),
+               (100.0 * cycles) / std::max((uint64_t)1, search));
+    }
+    printf("(%llu cycles of timer overhead taken off each call)\n\n", (unsigned long long)overhead);
+}
+#endif
+
+int depth_search(int color, int depth_cap, int max_seconds, bool verbose) {
+    // iterations stop at depth_cap or once max_seconds are used up (never when it is 0).
+    // With no time limit every run searches the same nodes, verbose prints each iteration
     iteration_depth = 1;
     int move;
-    clock_t start = time(0);
-    while (((time(0) - start) < MAX_SEARCH_TIME) && (iteration_depth <= depth_cap)) {
+    auto start = std::chrono::steady_clock::now();
+    auto seconds = [&start]() { return std::chrono::duration_cast<std::chrono::seconds>(std::chrono::steady_clock::now() - start).count(); };
+#ifdef SEARCH_PROFILE
+    std::fill(profile_cycles, profile_cycles + PROFILE_SECTIONS, 0);
+    std::fill(profile_calls, profile_calls + PROFILE_SECTIONS, 0);
+#endif
+    while (((max_seconds == 0) || (seconds() < max_seconds)) && (iteration_depth <= depth_cap)) {
         // clear engine statistics from previous iteration
-        m_nodes = 0; cut_offs = 0; late_move_reductions = 0; hash_entries = 0;
-        q_nodes = 0; max_quiescence_search_depth = 0; called = 0;
+        search_stats = SearchStats();
+        eval_probes = 0; eval_hits = 0; pawn_probes = 0; pawn_hits = 0;
 
         // run current iteration
-        auto init = std::chrono::high_resolution_clock::now();
-        move = minimax(color, iteration_depth, 0, -2000000, 2000000);
-        auto end = std::chrono::high_resolution_clock::now();
-        auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(end - init);
-        timer2 += duration.count();
+        STATS(auto init = std::chrono::steady_clock::now());
+        {
+            PROFILE(PROFILE_SEARCH);
+            move = minimax(color, iteration_depth, 0, -2000000, 2000000);
+        }
+        STATS(record_search_stats(iteration_depth, std::chrono::steady_clock::now() - init));
+
+        total_nodes += (search_stats.minimax_nodes+search_stats.quiescence_nodes);
+        update_principle_variation();
 
-        total_nodes += (m_nodes+q_nodes);
         // print statistics
-        print_coords(move);
-        std::cout << "  reached depth " << iteration_depth << " in " << (time(0)-start) << " seconds" << std::endl;
-        std::cout << m_nodes << " minimax nodes";
-        std::cout << ", " << q_nodes << " quiesce nodes";
-        std::cout << ", " << total_nodes << " total nodes";
-        std::cout << ", " << cut_offs << " cut offs";
-        std::cout << ", " << late_move_reductions << " reductions";
-        std::cout << ", " << hash_entries << " hashes";
-        std::cout << ",  max q depth: " << max_quiescence_search_depth << std::endl;
-        //std::cout << gen_zobrist_key(color) << std::endl;
-        update_principle_variation(color);
-
-        std::cout << "best cont: ";
-        for (int i=0; i<iteration_depth; i++) {
-            int pv = principal_variation[i];
-            print_coords(pv);
-            std::cout << ", ";
-        }
-        std::cout << "\n\n";
+        if (verbose) {
+            print_coords(move);
+            std::cout << "  reached depth " << iteration_depth << " in " << seconds() << " seconds" << std::endl;
+            std::cout << search_stats.minimax_nodes << " minimax nodes";
+            std::cout << ", " << search_stats.quiescence_nodes << " quiesce nodes";
+            std::cout << ", " << total_nodes << " total nodes";
+            std::cout << ", " << search_stats.cut_offs << " cut offs";
+            std::cout << ", " << search_stats.reductions << " reductions";
+            std::cout << ", " << search_stats.tt_cutoffs << " hashes";
+            std::cout << ",  max q depth: " << search_stats.quiescence_depth;
+            std::cout << ", eval cache hits: " << (100 * eval_hits) / std::max(1, eval_probes) << "%";
+            std::cout << ", pawn hash hits: " << (100 * pawn_hits) / std::max(1, pawn_probes) << "%" << std::endl;
+            //std::cout << gen_zobrist_key(color) << std::endl;
+
+            std::cout << "best cont: ";
+            for (int i=0; (i<iteration_depth) && principal_variation[i]; i++) {
+                int pv = principal_variation[i];
+                print_coords(pv);
+                std::cout << ", ";
+            }
+            std::cout << "\n\n";
+        }
         iteration_depth++;
     }
+#ifdef SEARCH_PROFILE
+    if (verbose) { print_profile(); }
+#endif
     return move;
 }
 
+struct SearchLimits {
+    int depth;          // deepest iteration, as deep as possible when 0
+    long nodes;         // stop once this many nodes are searched, 0 for no limit
+    long milliseconds;  // stop once this much time is used, 0 for no limit
+    int multipv;        // best lines to report, 0 or 1 for the best move alone
+};
+
+struct SearchLine {
+    int move; int score; int depth;
+    std::vector<int> pv;
+};
+
+struct SearchSummary {
+    int move; int score; int depth;
+    long nodes; long milliseconds;
+    // when the final move was first chosen
+    int found_depth; long found_nodes; long found_milliseconds;
+};
+
+struct SearchResult : SearchSummary {
+    // kept out of the summary, which is plain data a forked search can send down a pipe
+    std::vector<SearchLine> lines; // in the order found, the first one is the move above
+};
+
+SearchLine search_line(int move) {
+    // the move and score the root search just returned and the variation stored behind it
+    SearchLine line = { move, root_eval, iteration_depth, {} };
+    for (int n=0; (n < iteration_depth) && principal_variation[n]; n++) { line.pv.push_back(principal_variation[n]); }
+    return line;
+}
+
+void extend_principal_variation(int color) {
+    // the variation ends where the search took a score from the transposition table, so
+    // the best moves stored behind that point carry it on while they are legal there
+    int length = 0;
+    while ((length < iteration_depth) && principal_variation[length]) {
+        make_move(principal_variation[length++]);
+        color = opp(color);
+    }
+    while (length < iteration_depth) {
+        uint64_t key = gen_zobrist_key(color);
+        HashEntry entry;
+        if (!read_hash_entry(gen_hash_index(key), key, entry) || (entry.best == 0)) { break; }
+        update_checks();
+        int num_moves = generate_color_moves_list(color, 1);
+        if (std::find(moves_list[0], moves_list[0] + num_moves, entry.best) == (moves_list[0] + num_moves)) { break; }
+        make_move(entry.best);
+        update_checks();
+        if (((color == white) && (pos[wK] & checks[1])) || ((color == black) && (pos[bK] & checks[0]))) {
+            takeback_move(entry.best);
+            break;
+        }
+        principal_variation[length++] = entry.best;
+        color = opp(color);
+    }
+    while (length > 0) { takeback_move(principal_variation[--length]); }
+    update_checks();
+}
+
+SearchResult limited_search(int color, const SearchLimits& limits) {
+    // depth_search without the printing, for the command line tools.  The time limit is
+    // checked between iterations, so the last iteration can run over.  The node limit
+    // also stops an iteration part way, except the first one, which always completes
+    SearchResult result = { { 0, 0, 0, 0, 0, 0, 0, 0 }, {} };
+    // the killer and variation tables are indexed one past the depth, so stop a ply short
+    int depth_cap = ((limits.depth > 0) ? std::min(limits.depth, MAX_DEPTH-1) : MAX_DEPTH-1);
+    auto start = std::chrono::steady_clock::now();
+    update_checks();
+    int num_lines = std::min(std::max(limits.multipv, 1), MAX_MULTIPV);
+    for (iteration_depth = 1; iteration_depth <= depth_cap; iteration_depth++) {
+        search_stats = SearchStats();
+        STATS(auto init = std::chrono::steady_clock::now());
+        iteration_node_limit = (((limits.nodes > 0) && (iteration_depth > 1)) ? (limits.nodes - result.nodes) : 0);
+        search_aborted = false;
+        int move = minimax(color, iteration_depth, 0, -2000000, 2000000);
+        if (search_aborted) { break; }
+        update_principle_variation();
+        extend_principal_variation(color);
+        std::vector<SearchLine> lines = { search_line(move) };
+        if (num_lines > 1) {
+            // search the root again without the moves found so far.  These searches neither
+            // read nor write the transposition table: its entries were left by other windows,
+            // so a line's score would depend on what the table happened to hold.  Their
+            // ordering tables are thrown away afterwards, so the best line comes out the
+            // same as without multipv
+            Move best_variation[MAX_DEPTH];
+            std::copy(principal_variation, principal_variation + MAX_DEPTH, best_variation);
+            std::vector<int> previous_evals(&layer_previous_evals[0][0], &layer_previous_evals[0][0] + (MAX_DEPTH * 4096));
+            Move best_moves[MAX_DEPTH]; Move killer_moves[MAX_DEPTH];
+            std::copy(layer_best_moves, layer_best_moves + MAX_DEPTH, best_moves);
+            std::copy(layer_killer_moves, layer_killer_moves + MAX_DEPTH, killer_moves);
+            auto restore_ordering = [&]() {
+                // every line starts from the ordering the best line left
+                std::copy(best_variation, best_variation + MAX_DEPTH, principal_variation);
+                std::copy(previous_evals.begin(), previous_evals.end(), &layer_previous_evals[0][0]);
+                std::copy(best_moves, best_moves + MAX_DEPTH, layer_best_moves);
+                std::copy(killer_moves, killer_moves + MAX_DEPTH, layer_killer_moves);
+            };
+            root_excluded = 0;
+            while (((int)lines.size() < num_lines) && lines.back().move) {
+                root_exclusions[root_excluded++] = lines.back().move;
+                restore_ordering();
+                int next = minimax(color, iteration_depth, 0, -2000000, 2000000);
+                if (next == 0) { break; }
+                update_principle_variation();
+                lines.push_back(search_line(next));
+#ifdef SEARCH_STATS
+                // the line must come out the same when the table has nothing to offer
+                if (!search_aborted) {
+                    SearchStats counted = search_stats;
+                    restore_ordering();
+                    hash_table_hidden = true;
+                    int cold = minimax(color, iteration_depth, 0, -2000000, 2000000);
+                    hash_table_hidden = false;
+                    if (!search_aborted && ((cold != next) || (root_eval != lines.back().score))) {
+                        std::cout << "MULTIPV LINE DEPENDS ON THE TRANSPOSITION TABLE AT DEPTH " << iteration_depth << ": ";
+                        print_coords(next); std::cout << " " << lines.back().score << " warm, ";
+                        print_coords(cold); std::cout << " " << root_eval << " cold" << std::endl;
+                    }
+                    search_stats = counted; search_aborted = false;
+                }
+#endif
+            }
+            root_excluded = 0;
+            // the next iteration is ordered by the best line
+            restore_ordering();
+            if (search_aborted) { break; }
+        }
+        auto now = std::chrono::steady_clock::now();
+        STATS(record_search_stats(iteration_depth, now - init));
+        result.nodes += (search_stats.minimax_nodes + search_stats.quiescence_nodes);
+        result.milliseconds = std::chrono::duration_cast<std::chrono::milliseconds>(now - start).count();
+        if ((move != result.move) || (result.found_depth == 0)) {
+            result.found_depth = iteration_depth; result.found_nodes = result.nodes;
+            result.found_milliseconds = result.milliseconds;
+        }
+        result.move = move; result.depth = iteration_depth;
+        result.score = lines[0].score;
+        result.lines = lines;
+
+        if ((limits.nodes > 0) && (result.nodes >= limits.nodes)) { break; }
+        if ((limits.milliseconds > 0) && (result.milliseconds >= limits.milliseconds)) { break; }
+    }
+    if (search_aborted) {
+        // the unfinished iteration is dropped but the nodes it used still count
+        result.nodes += (search_stats.minimax_nodes + search_stats.quiescence_nodes);
+        result.milliseconds = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+    }
+    iteration_node_limit = 0; search_aborted = false;
+    return result;
+}
+
 /////////////////////////////////////////////////////////////////////////////////////
-// PLAYER INTERFACE
+// ALGEBRAIC NOTATION
+// standard algebraic moves (e.g. "Nbd7", "exd5", "O-O", "e8=Q+") are matched against
+// the generated move list so games and test suites can be replayed on the board
 /////////////////////////////////////////////////////////////////////////////////////
-void print_title() {
-    std::cout << "KITTY BOX COMMAND LINE CHESS ENGINE\n" << std::endl;
+int square_index(char file, char rank) {
+    return (8*(rank - '1') + ('h' - file));
 }
 
-void set_position() {
-    char choice;
-    std::cout << "PLAY A STANDARD GAME?" << std::endl;
-    std::cout << "[Y]:yes [N]:enter FEN\nENTER: ";
+std::string move_to_string(int move) {
+    // coordinate notation (e.g. "e2e4", "e7e8q"), read before the move is made
+    int origination = move_origination(move); int destination = move_destination(move);
+    std::string text = { char('h' - origination%8), char('1' + origination/8), char('h' - destination%8), char('1' + destination/8) };
+    if (move_is_promotion(move)) { text += "nbrq"[promotion_piece(move) - wN]; }
+    return text;
+}
 
-    std::cin >> choice;
-    choice = toupper(choice);
+bool move_is_legal(int move, int color) {
+    // play the move and make sure it does not leave the king in check
+    if (move == 0) { return false; }
+    uint64_t saved_checks[2] = { checks[0], checks[1] };
+    make_move(move);
+    update_checks();
+    bool legal;
+    if (color == white) { legal = ((pos[wK] & checks[1]) == 0); }
+    else { legal = ((pos[bK] & checks[0]) == 0); }
+    takeback_move(move);
+    checks[0] = saved_checks[0]; checks[1] = saved_checks[1];
+    return legal;
+}
 
-    if (choice == 'Y') {
-        new_game();
-    }
-    else {
-        std::string fen;
-        std::cout << "\nENTER FEN: ";
-        std::cin >> fen;
-        read_FEN(fen);
+int promotion_letter(char letter) {
+    // the white piece ID a promotion letter stands for, 0 if it is not one
+    switch (toupper(letter)) {
+        case 'N': return wN;
+        case 'B': return wB;
+        case 'R': return wR;
+        case 'Q': return wQ;
+        default: return 0;
     }
 }
 
-void assign_colors(){
-    char color;
-    std::cout << "\nSELECT COLOR TO BEGIN:\n[W]:white [B]:black [R]:random\nENTER: ";
-    std::cin >> color;
-    color = toupper(color);
+int parse_SAN(std::string san, int color, int depth) {
+    // strip check marks and annotations
+    while (!san.empty() && ((san.back() == '+') || (san.back() == '#') || (san.back() == '!') || (san.back() == '?'))) {
+        san.pop_back();
+    }
+    if (san.length() < 2) { return 0; }
 
-    if (color == 'W') {
-        player = white;
-        computer = black;
+    // castling
+    if ((san == "O-O") || (san == "0-0")) {
+        if (color == white) { san = "Kg1"; } else { san = "Kg8"; }
     }
-    else if (color == 'B') {
-        player = black;
-        computer = white;
+    else if ((san == "O-O-O") || (san == "0-0-0")) {
+        if (color == white) { san = "Kc1"; } else { san = "Kc8"; }
     }
-    else if (color == 'R') {
-        int selector = (rand() % 2);
-        player = (13 + selector);
-        computer = (14 - selector);
+
+    // promotions are written "e8=Q" or "e8Q"
+    int promotion = 0;
+    size_t equals = san.find('=');
+    if (equals != std::string::npos) {
+        if (equals + 1 >= san.length()) { return 0; }
+        promotion = promotion_letter(san[equals+1]);
+        if (promotion == 0) { return 0; }
+        san = san.substr(0, equals);
     }
-    else {
-        std::cout << "INVALID OPTION" << std::endl;
-        return assign_colors();
+    else if ((san.length() > 2) && (islower(san[0])) && isupper(san.back()) && promotion_letter(san.back())) {
+        promotion = promotion_letter(san.back());
+        san.pop_back();
+    }
+
+    int piece = wP;
+    if (san[0] == 'N') { piece = wN; }
+    else if (san[0] == 'B') { piece = wB; }
+    else if (san[0] == 'R') { piece = wR; }
+    else if (san[0] == 'Q') { piece = wQ; }
+    else if (san[0] == 'K') { piece = wK; }
+    if (color == black) { piece += bP; }
+    if (piece%6 != wP) { san = san.substr(1); }
+
+    if ((san.length() < 2) || (san[san.length()-2] < 'a') || (san[san.length()-2] > 'h')
+        || (san.back() < '1') || (san.back() > '8')) { return 0; }
+    int destination = square_index(san[san.length()-2], san.back());
+
+    // anything left over disambiguates the origin
+    char from_file = 0; char from_rank = 0;
+    for (int i=0; i<(int)san.length()-2; i++) {
+        if ((san[i] >= 'a') && (san[i] <= 'h')) { from_file = san[i]; }
+        else if ((san[i] >= '1') && (san[i] <= '8')) { from_rank = san[i]; }
+    }
+
+    int num_moves = generate_color_moves_list(color, depth);
+    for (int i=0; i<num_moves; i++) {
+        int move = moves_list[depth-1][i];
+        int origination = move_origination(move);
+        if (move_destination(move) != destination) { continue; }
+        if ((pos[piece] & (1ULL << origination)) == 0) { continue; }
+        if (move_is_promotion(move) && (promotion_piece(move) != (promotion ? promotion : wQ))) { continue; }
+        if (from_file && (('h' - origination%8) != from_file)) { continue; }
+        if (from_rank && (('1' + origination/8) != from_rank)) { continue; }
+        if (move_is_legal(move, color)) { return move; }
+    }
+    return 0;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////
+// OPENING BOOK
+// known opening theory is looked up in a polyglot .bin book instead of searched.
+// The book is a sorted list of 16 byte big-endian entries (key, move, weight, learn)
+// which is mapped read-only into memory, so a lookup is just a binary search on the
+// key and never allocates or copies anything.
+/////////////////////////////////////////////////////////////////////////////////////
+const unsigned char* book_data = nullptr;
+size_t book_size = 0;
+size_t book_entries = 0;
+const int BOOK_ENTRY_SIZE = 16;
+
+uint64_t read_big_endian(const unsigned char* bytes, int num_bytes) {
+    uint64_t value = 0;
+    for (int i=0; i<num_bytes; i++) { value = ((value << 8) | bytes[i]); }
+    return value;
+}
+
+int polyglot_square(int index) {
+    // polyglot counts files from a while the engine counts them from h
+    return (8*(index/8) + (7 - index%8));
+}
+
+int engine_square(int polyglot_index) {
+    return (8*(polyglot_index/8) + (7 - polyglot_index%8));
+}
+
+uint64_t gen_polyglot_key(int side_to_move) {
+    uint64_t key = 0;
+    for (int piece=0; piece<12; piece++) {
+        // polyglot orders pieces as bP, wP, bN, wN, ... bK, wK
+        int kind = (2*(piece%6) + (piece < 6));
+        uint64_t bits = pos[piece];
+        while (bits) {
+            int i = bit_scan_left(bits);
+            key ^= POLYGLOT_RANDOM[64*kind + polyglot_square(i)];
+            bits &= (bits - 1);
+        }
+    }
+
+    // the castling rights bits are in polyglot order
+    for (int i=0; i<4; i++) {
+        if (castling_rights & (1 << i)) { key ^= POLYGLOT_RANDOM[pg_castle+i]; }
+    }
+
+    // en passant only counts if a pawn is actually able to capture
+    if ((side_to_move == white) && en_passant_b && (gen_bP_attks(bit_scan_left(en_passant_b)) & pos[wP])) {
+        key ^= POLYGLOT_RANDOM[pg_en_passant + (7 - bit_scan_left(en_passant_b)%8)];
+    }
+    else if ((side_to_move == black) && en_passant_w && (gen_wP_attks(bit_scan_left(en_passant_w)) & pos[bP])) {
+        key ^= POLYGLOT_RANDOM[pg_en_passant + (7 - bit_scan_left(en_passant_w)%8)];
+    }
+
+    if (side_to_move == white) { key ^= POLYGLOT_RANDOM[pg_turn]; }
+    return key;
+}
+
+bool open_book(const char* path) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) { return false; }
+    struct stat info;
+    if ((fstat(fd, &info) != 0) || (info.st_size < BOOK_ENTRY_SIZE)) { close(fd); return false; }
+
+    void* data = mmap(nullptr, info.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) { return false; }
+    madvise(data, info.st_size, MADV_RANDOM);
+
+    book_data = (const unsigned char*)data;
+    book_size = info.st_size;
+    book_entries = (book_size / BOOK_ENTRY_SIZE);
+    return true;
+}
+
+void close_book() {
+    if (book_data) { munmap((void*)book_data, book_size); }
+    book_data = nullptr; book_size = 0; book_entries = 0;
+}
+
+int decode_book_move(int polyglot_move, int color) {
+    // the generated move, so key collisions and books built with a different key table
+    // can't play anything illegal (0 when there is no such move)
+    int destination = engine_square(polyglot_move & 63);
+    int origination = engine_square((polyglot_move >> 6) & 63);
+    int promotion = ((polyglot_move >> 12) & 7); // same numbers as wN to wQ
+
+    // polyglot castles by moving the king onto its own rook
+    if ((pos[wK] | pos[bK]) & (1ULL << origination)) {
+        if ((origination == 3) && (destination == 0)) { destination = 1; }
+        else if ((origination == 3) && (destination == 7)) { destination = 5; }
+        else if ((origination == 59) && (destination == 56)) { destination = 57; }
+        else if ((origination == 59) && (destination == 63)) { destination = 61; }
+    }
+    if ((pos[color] & (1ULL << origination)) == 0) { return 0; }
+    return find_move(color, origination, destination, promotion, 1);
+}
+
+int probe_book(int color) {
+    if (book_entries == 0) { return 0; }
+    uint64_t key = gen_polyglot_key(color);
+
+    // binary search for the first entry with this key
+    size_t low = 0; size_t high = book_entries;
+    while (low < high) {
+        size_t mid = (low + high) / 2;
+        if (read_big_endian(book_data + mid*BOOK_ENTRY_SIZE, 8) < key) { low = mid + 1; }
+        else { high = mid; }
+    }
+
+    // entries with the same key are contiguous
+    int best_move = 0; int best_weight = -1;
+    int total_weight = 0; int chosen_move = 0;
+    for (size_t i=low; i<book_entries; i++) {
+        const unsigned char* entry = book_data + i*BOOK_ENTRY_SIZE;
+        if (read_big_endian(entry, 8) != key) { break; }
+        int move = decode_book_move(read_big_endian(entry + 8, 2), color);
+        int weight = read_big_endian(entry + 10, 2);
+        if ((move == 0) || (weight == 0)) { continue; }
+
+        if (weight > best_weight) { best_weight = weight; best_move = move; }
+        // reservoir sampling gives a weighted random pick in one pass
+        total_weight += weight;
+        if ((rand() % total_weight) < weight) { chosen_move = move; }
+    }
+
+    if (BOOK_BEST_MOVE) { return best_move; }
+    else { return chosen_move; }
+}
+
+/////////////////////////////////////////////////////////////////////////////////////
+// OPENING BOOK BUILDER
+// PGN game collections are streamed through a pool of worker threads which replay
+// every game on their own board and count how often each move was played from each
+// position (and how it scored).  Every worker keeps its own shard of the statistics,
+// so no locking is needed until the shards are merged and written out as a sorted
+// polyglot book.
+/////////////////////////////////////////////////////////////////////////////////////
+struct BookStats {
+    uint64_t key;
+    int move;
+    uint32_t weight; // 2 per win and 1 per draw for the side that played the move
+    uint32_t games;
+};
+
+uint64_t book_stats_index(uint64_t key, int polyglot_move) {
+    // position key and move share one map key; the move only has 15 bits
+    return (((key << 15) | (key >> 49)) ^ polyglot_move);
+}
+
+struct BookShard {
+    std::unordered_map<uint64_t, BookStats> stats;
+    long games = 0;
+};
+
+struct BookQueue {
+    std::vector<std::vector<std::string>> batches;
+    std::mutex lock;
+    std::condition_variable not_empty;
+    std::condition_variable not_full;
+    bool finished = false;
+};
+
+const int BOOK_BATCH_SIZE = 64;   // games handed to a worker at a time
+const int BOOK_QUEUE_LENGTH = 16; // batches waiting in memory at most
+
+int encode_book_move(int move) {
+    int origination = move_origination(move);
+    int destination = move_destination(move);
+    // polyglot castles by moving the king onto its own rook
+    if ((pos[wK] | pos[bK]) & (1ULL << origination)) {
+        if ((origination == 3) && (destination == 1)) { destination = 0; }
+        else if ((origination == 3) && (destination == 5)) { destination = 7; }
+        else if ((origination == 59) && (destination == 57)) { destination = 56; }
+        else if ((origination == 59) && (destination == 61)) { destination = 63; }
+    }
+    int polyglot_move = ((polyglot_square(origination) << 6) | polyglot_square(destination));
+    if (move_is_promotion(move)) { polyglot_move |= (promotion_piece(move) << 12); }
+    return polyglot_move;
+}
+
+void prune_book_shard(BookShard& shard) {
+    // drop positions that were only seen once, then the next rarest ones, until half the
+    // limit is left.  Memory stays bounded and the shard is only scanned again after it
+    // has grown by as much as was freed
+    for (uint32_t rarest=1; shard.stats.size() > (size_t)BOOK_SHARD_LIMIT/2; rarest++) {
+        for (auto it = shard.stats.begin(); it != shard.stats.end(); ) {
+            if (it->second.games <= rarest) { it = shard.stats.erase(it); }
+            else { it++; }
+        }
+    }
+}
+
+void replay_book_game(const std::string& game, BookShard& shard) {
+    // read the result from the tags, the movetext is everything outside of them
+    int result = 0; // from white's point of view: 2 win, 1 draw, 0 loss, -1 unknown
+    if (game.find("[Result \"1-0\"]") != std::string::npos) { result = 2; }
+    else if (game.find("[Result \"0-1\"]") != std::string::npos) { result = 0; }
+    else if (game.find("[Result \"1/2-1/2\"]") != std::string::npos) { result = 1; }
+    else { return; }
+    // games from custom positions can not be replayed from the start
+    if (game.find("[FEN ") != std::string::npos) { return; }
+
+    new_game();
+    int color = white;
+    int ply = 0;
+    int comment_depth = 0; int variation_depth = 0;
+    size_t i = 0;
+    while ((i < game.length()) && (ply < BOOK_MAX_PLY)) {
+        char c = game[i];
+        // skip tags, comments, variations and whitespace
+        if ((c == '[') && (comment_depth == 0) && (variation_depth == 0)) {
+            while ((i < game.length()) && (game[i] != '\n')) { i++; }
+            continue;
+        }
+        if (c == '{') { comment_depth++; i++; continue; }
+        if (c == '}') { comment_depth--; i++; continue; }
+        if (comment_depth > 0) { i++; continue; }
+        if (c == ';') {
+            while ((i < game.length()) && (game[i] != '\n')) { i++; }
+            continue;
+        }
+        if (c == '(') { variation_depth++; i++; continue; }
+        if (c == ')') { variation_depth--; i++; continue; }
+        if ((variation_depth > 0) || isspace(c)) { i++; continue; }
+
+        // read one token
+        size_t start = i;
+        while ((i < game.length()) && !isspace(game[i]) && (game[i] != '{') && (game[i] != '(') && (game[i] != ';')) { i++; }
+        std::string token = game.substr(start, i - start);
+
+        // move numbers may be glued to the move ("12.e4", "12...e5")
+        size_t dots = token.find_last_of('.');
+        if (dots != std::string::npos) { token = token.substr(dots + 1); }
+        if (token.empty() || isdigit(token[0]) || (token[0] == '$') || (token[0] == '*')) { continue; }
+
+        int move = parse_SAN(token, color, 1);
+        if (move == 0) { break; }
+
+        uint64_t key = gen_polyglot_key(color);
+        int polyglot_move = encode_book_move(move);
+        BookStats& stats = shard.stats[book_stats_index(key, polyglot_move)];
+        stats.key = key; stats.move = polyglot_move;
+        stats.games++;
+        if (color == white) { stats.weight += result; }
+        else { stats.weight += (2 - result); }
+
+        make_move(move);
+        color = opp(color);
+        ply++;
+    }
+    shard.games++;
+    if ((int)shard.stats.size() > BOOK_SHARD_LIMIT) { prune_book_shard(shard); }
+}
+
+void book_worker(BookQueue& queue, BookShard& shard) {
+    while (true) {
+        std::vector<std::string> batch;
+        {
+            std::unique_lock<std::mutex> guard(queue.lock);
+            queue.not_empty.wait(guard, [&] { return !queue.batches.empty() || queue.finished; });
+            if (queue.batches.empty()) { return; }
+            batch = std::move(queue.batches.back());
+            queue.batches.pop_back();
+        }
+        queue.not_full.notify_one();
+        for (const std::string& game : batch) { replay_book_game(game, shard); }
+    }
+}
+
+void push_book_batch(BookQueue& queue, std::vector<std::string>& batch) {
+    std::unique_lock<std::mutex> guard(queue.lock);
+    queue.not_full.wait(guard, [&] { return (int)queue.batches.size() < BOOK_QUEUE_LENGTH; });
+    queue.batches.push_back(std::move(batch));
+    guard.unlock();
+    queue.not_empty.notify_one();
+    batch.clear();
+}
+
+void write_book_entry(FILE* file, uint64_t key, int move, int weight) {
+    unsigned char bytes[BOOK_ENTRY_SIZE] = {0};
+    for (int i=0; i<8; i++) { bytes[i] = (key >> (56 - 8*i)) & 255; }
+    bytes[8] = (move >> 8) & 255; bytes[9] = move & 255;
+    bytes[10] = (weight >> 8) & 255; bytes[11] = weight & 255;
+    fwrite(bytes, 1, BOOK_ENTRY_SIZE, file);
+}
+
+FILE* write_book_run(BookShard& shard) {
+    // the shard sorted by position and move into a temporary file, and its memory freed
+    std::vector<BookStats> entries;
+    entries.reserve(shard.stats.size());
+    for (auto& item : shard.stats) { entries.push_back(item.second); }
+    std::unordered_map<uint64_t, BookStats>().swap(shard.stats);
+    std::sort(entries.begin(), entries.end(), [](const BookStats& a, const BookStats& b) {
+        if (a.key != b.key) { return a.key < b.key; }
+        return a.move < b.move;
+    });
+    FILE* file = tmpfile();
+    if (file == nullptr) { return nullptr; }
+    if (fwrite(entries.data(), sizeof(BookStats), entries.size(), file) != entries.size()) { fclose(file); return nullptr; }
+    rewind(file);
+    return file;
+}
+
+long write_book_position(FILE* file, std::vector<BookStats>& moves) {
+    // the moves of one position that scored at all, best first
+    moves.erase(std::remove_if(moves.begin(), moves.end(), [](const BookStats& stats) { return (stats.weight == 0); }), moves.end());
+    std::stable_sort(moves.begin(), moves.end(), [](const BookStats& a, const BookStats& b) { return a.weight > b.weight; });
+    // weights are 16 bit, so scale down positions with very popular moves
+    uint32_t max_weight = (moves.empty() ? 0 : moves[0].weight);
+    for (const BookStats& stats : moves) {
+        uint64_t weight = stats.weight;
+        if (max_weight > 65535) { weight = std::max<uint64_t>(1, (weight * 65535) / max_weight); }
+        write_book_entry(file, stats.key, stats.move, (int)weight);
+    }
+    long written = moves.size();
+    moves.clear();
+    return written;
+}
+
+int build_book(const char* pgn_path, const char* book_path) {
+    std::ifstream pgn(pgn_path);
+    if (!pgn) { std::cout << "CANNOT OPEN " << pgn_path << std::endl; return 1; }
+
+    int num_threads = std::max(1u, std::thread::hardware_concurrency());
+    std::vector<BookShard> shards(num_threads);
+    BookQueue queue;
+    std::vector<std::thread> workers;
+    for (int t=0; t<num_threads; t++) {
+        workers.emplace_back(book_worker, std::ref(queue), std::ref(shards[t]));
+    }
+
+    // split the stream into games; a tag line after movetext starts a new game
+    auto start = std::chrono::high_resolution_clock::now();
+    std::vector<std::string> batch;
+    std::string game; std::string line;
+    bool in_movetext = false;
+    while (std::getline(pgn, line)) {
+        if (!line.empty() && (line[0] == '[') && in_movetext) {
+            batch.push_back(std::move(game));
+            game.clear(); in_movetext = false;
+            if ((int)batch.size() >= BOOK_BATCH_SIZE) { push_book_batch(queue, batch); }
+        }
+        else if (!line.empty() && (line[0] != '[') && (line[0] != '%')) { in_movetext = true; }
+        game += line; game += '\n';
+    }
+    if (in_movetext) { batch.push_back(std::move(game)); }
+    if (!batch.empty()) { push_book_batch(queue, batch); }
+    {
+        std::lock_guard<std::mutex> guard(queue.lock);
+        queue.finished = true;
+    }
+    queue.not_empty.notify_all();
+    for (std::thread& worker : workers) { worker.join(); }
+
+    // every shard is sorted into a run of its own, then the runs are merged a position at
+    // a time, so only one shard is ever held twice and the merged book is never in memory
+    long games = 0;
+    std::vector<FILE*> runs;
+    for (BookShard& shard : shards) {
+        games += shard.games;
+        FILE* run = write_book_run(shard);
+        if (run == nullptr) { std::cout << "CANNOT WRITE A TEMPORARY FILE" << std::endl; return 1; }
+        runs.push_back(run);
+    }
+    FILE* file = fopen(book_path, "wb");
+    if (file == nullptr) { std::cout << "CANNOT WRITE " << book_path << std::endl; return 1; }
+
+    std::vector<BookStats> heads(runs.size());
+    auto later = [&heads](int a, int b) {
+        if (heads[a].key != heads[b].key) { return heads[a].key > heads[b].key; }
+        return heads[a].move > heads[b].move;
+    };
+    std::priority_queue<int, std::vector<int>, decltype(later)> next_run(later);
+    for (size_t r=0; r<runs.size(); r++) {
+        if (fread(&heads[r], sizeof(BookStats), 1, runs[r]) == 1) { next_run.push(r); }
+    }
+    std::vector<BookStats> position; // the moves of the position being merged
+    long written = 0;
+    while (!next_run.empty()) {
+        int r = next_run.top(); next_run.pop();
+        BookStats stats = heads[r];
+        if (fread(&heads[r], sizeof(BookStats), 1, runs[r]) == 1) { next_run.push(r); }
+        if (!position.empty() && (position.back().key == stats.key) && (position.back().move == stats.move)) {
+            position.back().weight += stats.weight; position.back().games += stats.games;
+            continue;
+        }
+        if (!position.empty() && (position.back().key != stats.key)) { written += write_book_position(file, position); }
+        position.push_back(stats);
+    }
+    written += write_book_position(file, position);
+    fclose(file);
+    for (FILE* run : runs) { fclose(run); }
+
+    auto end = std::chrono::high_resolution_clock::now();
+    auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(end - start);
+    std::cout << games << " games, " << written << " book entries written to " << book_path;
+    std::cout << " in " << duration.count() << " ms using " << num_threads << " threads" << std::endl;
+    return 0;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////
+// EVALUATION TUNING
+// the hand set weights are fitted to game results (Texel's method).  Every labelled
+// position is first played out through its captures until it is quiet, and only that
+// quiet position is kept.  The tuner then nudges one weight at a time, keeping a change
+// whenever it lowers the mean squared error between each result and the win chance
+// predicted by the evaluation.  The positions are scored in parallel, one slice per core.
+//
+// positions come from EPD lines (FEN fields followed by a result such as c9 "1-0" or
+// [0.5]) and are cached in a packed file next to them, so the capture searches and
+// parsing only happen once.
+/////////////////////////////////////////////////////////////////////////////////////
+struct TuningPosition {
+    uint64_t pieces[12];
+    uint64_t attacks[2];
+    uint64_t pawns;     // pawn zobrist key for the pawn hash
+    uint8_t result;     // points for white in halves: 0, 1 or 2
+};
+
+struct TuningParameter {
+    int* value;
+    int step;
+};
+
+void save_tuning_position(TuningPosition& position) {
+    for (int piece=0; piece<12; piece++) { position.pieces[piece] = pos[piece]; }
+    position.attacks[0] = checks[0]; position.attacks[1] = checks[1];
+    position.pawns = pawn_key;
+}
+
+void load_tuning_position(const TuningPosition& position) {
+    for (int piece=0; piece<12; piece++) { pos[piece] = position.pieces[piece]; }
+    checks[0] = position.attacks[0]; checks[1] = position.attacks[1];
+    pawn_key = position.pawns;
+    update_colors(); init_material();
+}
+
+int tuning_quiescence(int color, int depth, int alpha, int beta, TuningPosition& leaf) {
+    // a plain capture search that remembers which quiet position its score came from
+    save_tuning_position(leaf);
+    int best_eval = node_evaluation();
+    if (color == black) { best_eval *= -1; }
+    if ((best_eval >= beta) || (depth >= TUNE_Q_DEPTH)) { return best_eval; }
+    alpha = std::max(alpha, best_eval);
+
+    int num_moves = generate_color_attks_list(color, depth+1);
+    score_captures(num_moves, color, depth+1);
+    TuningPosition child;
+    for (int i=0; i<num_moves; i++) {
+        int move = get_next_best_move(i, num_moves, depth+1);
+        if ((pos[wK] | pos[bK]) & (1ULL << move_destination(move))) { continue; }
+        make_move(move);
+        update_checks();
+        int eval = -tuning_quiescence(opp(color), depth+1, -beta, -alpha, child);
+        takeback_move(move);
+        if (eval > best_eval) { best_eval = eval; leaf = child; }
+        alpha = std::max(alpha, best_eval);
+        if (alpha >= beta) { break; }
+    }
+    return best_eval;
+}
+
+bool parse_tuning_line(const std::string& line, std::string& board, int& color, int& result) {
+    size_t space = line.find(' ');
+    if ((space == std::string::npos) || (space + 1 >= line.size())) { return false; }
+    board = line.substr(0, space);
+    color = ((line[space+1] == 'b') ? black : white);
+    if ((line.find("1/2-1/2") != std::string::npos) || (line.find("0.5") != std::string::npos)) { result = 1; }
+    else if ((line.find("1-0") != std::string::npos) || (line.find("[1") != std::string::npos)) { result = 2; }
+    else if ((line.find("0-1") != std::string::npos) || (line.find("[0") != std::string::npos)) { result = 0; }
+    else { return false; }
+    return true;
+}
+
+void resolve_tuning_positions(const std::vector<std::string>& lines, std::vector<TuningPosition>& positions, size_t first, size_t last) {
+    std::string board; int color; int result;
+    for (size_t i=first; i<last; i++) {
+        positions[i].result = 255;
+        if (!parse_tuning_line(lines[i], board, color, result)) { continue; }
+        read_FEN(board);
+        if ((count(pos[wK]) != 1) || (count(pos[bK]) != 1)) { continue; }
+        update_checks();
+        tuning_quiescence(color, 0, -2000000, 2000000, positions[i]);
+        positions[i].result = result;
+    }
+}
+
+bool load_tuning_positions(const std::string& path, std::vector<TuningPosition>& positions) {
+    // reuse the packed positions if this same file was read before; the header records
+    // the size and modification time of the EPD file they were made from
+    std::string packed_path = path + ".bin";
+    struct stat info;
+    uint64_t source[2] = { 0, 0 };
+    if (stat(path.c_str(), &info) == 0) { source[0] = info.st_size; source[1] = info.st_mtime; }
+    FILE* packed = fopen(packed_path.c_str(), "rb");
+    if (packed != nullptr) {
+        char magic[4]; uint64_t packed_source[2] = { 0, 0 }; uint64_t size = 0;
+        if ((fread(magic, 1, 4, packed) == 4) && (std::string(magic, 4) == "KBT2") && (fread(packed_source, sizeof(uint64_t), 2, packed) == 2)
+            && (packed_source[0] == source[0]) && (packed_source[1] == source[1]) && (fread(&size, sizeof(size), 1, packed) == 1)) {
+            positions.resize(size);
+            size_t read = fread(positions.data(), sizeof(TuningPosition), size, packed);
+            fclose(packed);
+            if (read == size) { return true; }
+        }
+        else { fclose(packed); }
+        positions.clear();
+    }
+
+    std::ifstream epd(path);
+    if (!epd) { std::cout << "CANNOT OPEN " << path << std::endl; return false; }
+    std::vector<std::string> lines;
+    std::string line;
+    while (std::getline(epd, line)) {
+        if (!line.empty()) { lines.push_back(std::move(line)); }
+    }
+    positions.resize(lines.size());
+
+    int num_threads = std::max(1u, std::thread::hardware_concurrency());
+    std::vector<std::thread> workers;
+    size_t slice = (lines.size() + num_threads - 1) / num_threads;
+    for (int t=0; t<num_threads; t++) {
+        size_t first = std::min(lines.size(), t*slice);
+        size_t last = std::min(lines.size(), first + slice);
+        workers.emplace_back(resolve_tuning_positions, std::cref(lines), std::ref(positions), first, last);
+    }
+    for (std::thread& worker : workers) { worker.join(); }
+    positions.erase(std::remove_if(positions.begin(), positions.end(), [](const TuningPosition& position) {
+        return (position.result == 255);
+    }), positions.end());
+
+    packed = fopen(packed_path.c_str(), "wb");
+    if (packed != nullptr) {
+        uint64_t size = positions.size();
+        fwrite("KBT2", 1, 4, packed);
+        fwrite(source, sizeof(uint64_t), 2, packed);
+        fwrite(&size, sizeof(size), 1, packed);
+        fwrite(positions.data(), sizeof(TuningPosition), size, packed);
+        fclose(packed);
+        std::cout << "saved quiet positions to " << packed_path << std::endl;
+    }
+    return true;
+}
+
+double win_chance(int evaluation, double k) {
+    return (1.0 / (1.0 + pow(10.0, -k * evaluation / 400.0)));
+}
+
+// the weights change between calls but the positions do not, so one worker per core
+// lives for the whole run and scores its own slice of the positions each generation
+struct TuningPool {
+    const std::vector<TuningPosition>* positions;
+    std::vector<std::thread> workers;
+    std::vector<double> errors;
+    double k = 0;
+    uint64_t generation = 0;
+    int pending = 0;
+    bool stopping = false;
+    std::mutex lock;
+    std::condition_variable start;
+    std::condition_variable finished;
+};
+
+void tuning_worker(TuningPool& pool, int index) {
+    const std::vector<TuningPosition>& positions = *pool.positions;
+    size_t slice = (positions.size() + pool.errors.size() - 1) / pool.errors.size();
+    size_t first = std::min(positions.size(), index*slice);
+    size_t last = std::min(positions.size(), first + slice);
+    uint64_t seen = 0;
+    while (true) {
+        double k;
+        {
+            std::unique_lock<std::mutex> guard(pool.lock);
+            pool.start.wait(guard, [&pool, seen]() { return (pool.stopping || (pool.generation != seen)); });
+            if (pool.stopping) { return; }
+            seen = pool.generation; k = pool.k;
+        }
+        double error = 0;
+        for (size_t i=first; i<last; i++) {
+            load_tuning_position(positions[i]);
+            double difference = (positions[i].result / 2.0) - win_chance(node_evaluation(), k);
+            error += (difference * difference);
+        }
+        std::lock_guard<std::mutex> guard(pool.lock);
+        pool.errors[index] = error;
+        if (--pool.pending == 0) { pool.finished.notify_one(); }
+    }
+}
+
+void start_tuning_pool(TuningPool& pool, const std::vector<TuningPosition>& positions) {
+    int num_threads = std::max(1u, std::thread::hardware_concurrency());
+    pool.positions = &positions;
+    pool.errors.assign(num_threads, 0);
+    for (int t=0; t<num_threads; t++) { pool.workers.emplace_back(tuning_worker, std::ref(pool), t); }
+}
+
+void stop_tuning_pool(TuningPool& pool) {
+    {
+        std::lock_guard<std::mutex> guard(pool.lock);
+        pool.stopping = true;
+    }
+    pool.start.notify_all();
+    for (std::thread& worker : pool.workers) { worker.join(); }
+    pool.workers.clear();
+}
+
+double tuning_error(TuningPool& pool, double k) {
+    // the pawn hash still holds scores made with the old weights
+    clear_pawn_hash();
+    std::unique_lock<std::mutex> guard(pool.lock);
+    pool.k = k;
+    pool.pending = pool.workers.size();
+    pool.generation++;
+    pool.start.notify_all();
+    pool.finished.wait(guard, [&pool]() { return (pool.pending == 0); });
+    double error = 0;
+    for (double e : pool.errors) { error += e; }
+    return (error / std::max<size_t>(1, pool.positions->size()));
+}
+
+double fit_win_chance_scale(TuningPool& pool) {
+    // ternary search for the k that best maps the current evaluation to results
+    double low = 0.1; double high = 3.0;
+    while ((high - low) > 0.01) {
+        double a = low + (high - low) / 3; double b = high - (high - low) / 3;
+        if (tuning_error(pool, a) < tuning_error(pool, b)) { high = b; }
+        else { low = a; }
+    }
+    return ((low + high) / 2);
+}
+
+void write_parameter_row(FILE* file, const int* values, int length) {
+    // tables are laid out eight squares to a line like the ones in the source
+    fprintf(file, "{");
+    for (int i=0; i<length; i++) {
+        if ((length == 64) && (i > 0) && (i % 8 == 0)) { fprintf(file, "\n     "); }
+        fprintf(file, "%4d%s", values[i], (i == length-1) ? " }" : ",");
+    }
+}
+
+bool write_parameter_header(const char* header_path) {
+    FILE* file = fopen(header_path, "w");
+    if (file == nullptr) { std::cout << "CANNOT WRITE " << header_path << std::endl; return false; }
+    fprintf(file, "// evaluation weights written by \"full_version tune\"\n");
+    fprintf(file, "// build with -DKITTY_PARAMETERS='\"%s\"' to use them\n\n", header_path);
+    fprintf(file, "// piece values\n");
+    const char* names[6] = { "P_VAL", "N_VAL", "B_VAL", "R_VAL", "Q_VAL", "K_VAL" };
+    for (int i=0; i<6; i++) { fprintf(file, "int %s = %d;\n", names[i], VAL[i]); }
+    fprintf(file, "int VAL[6] = { P_VAL,  N_VAL,  B_VAL,  R_VAL,  Q_VAL,  K_VAL };\n\n");
+    fprintf(file, "int MOBILITY_INCENTIVE = %d;\n\n", MOBILITY_INCENTIVE);
+    fprintf(file, "// pawn structure\n");
+    fprintf(file, "int DOUBLED_PENALTY = %d;\n", DOUBLED_PENALTY);
+    fprintf(file, "int ISOLATED_PENALTY = %d;\n", ISOLATED_PENALTY);
+    fprintf(file, "int BACKWARD_PENALTY = %d;\n", BACKWARD_PENALTY);
+    fprintf(file, "int PASSED_BONUS[8] = ");
+    write_parameter_row(file, PASSED_BONUS, 8);
+    fprintf(file, ";\n\n");
+    fprintf(file, "// piece square tables: pawn, knight, bishop, rook, queen, king, king endgame\n");
+    fprintf(file, "int PST[7][64] = {\n");
+    for (int piece=0; piece<7; piece++) {
+        fprintf(file, "    ");
+        write_parameter_row(file, PST[piece], 64);
+        fprintf(file, "%s\n", (piece == 6) ? "" : ",");
+    }
+    fprintf(file, "};\n");
+    fclose(file);
+    return true;
+}
+
+void step_tuning_parameter(const TuningParameter& parameter, int step) {
+    *parameter.value += step;
+    // the material table's scaling compares piece values
+    if ((parameter.value >= VAL) && (parameter.value < VAL + 6)) { init_material_table(); }
+}
+
+int tune_evaluation(const char* positions_path, const char* header_path) {
+    auto start = std::chrono::high_resolution_clock::now();
+    std::vector<TuningPosition> positions;
+    if (!load_tuning_positions(positions_path, positions)) { return 1; }
+    std::cout << positions.size() << " quiet positions" << std::endl;
+    if (positions.empty()) { return 1; }
+
+    // the pawn is left alone to anchor the scale, and the king is never traded
+    std::vector<TuningParameter> parameters;
+    for (int piece=wN; piece<=wQ; piece++) { parameters.push_back({ &VAL[piece], 5 }); }
+    parameters.push_back({ &MOBILITY_INCENTIVE, 1 });
+    parameters.push_back({ &DOUBLED_PENALTY, 1 });
+    parameters.push_back({ &ISOLATED_PENALTY, 1 });
+    parameters.push_back({ &BACKWARD_PENALTY, 1 });
+    for (int rank=1; rank<7; rank++) { parameters.push_back({ &PASSED_BONUS[rank], 1 }); }
+    for (int piece=0; piece<7; piece++) {
+        for (int i=0; i<64; i++) {
+            // pawns never stand on the first or last rank
+            if ((piece == wP) && ((i < 8) || (i >= 56))) { continue; }
+            parameters.push_back({ &PST[piece][i], 1 });
+        }
+    }
+
+    TuningPool pool;
+    start_tuning_pool(pool, positions);
+    double k = fit_win_chance_scale(pool);
+    double best_error = tuning_error(pool, k);
+    std::cout << "k = " << k << ", starting error " << best_error << std::endl;
+
+    for (int pass=1; pass<=TUNE_MAX_PASSES; pass++) {
+        int improved = 0;
+        for (TuningParameter& parameter : parameters) {
+            step_tuning_parameter(parameter, parameter.step);
+            double error = tuning_error(pool, k);
+            if (error < best_error) { best_error = error; improved++; continue; }
+            step_tuning_parameter(parameter, -2*parameter.step);
+            error = tuning_error(pool, k);
+            if (error < best_error) { best_error = error; improved++; continue; }
+            step_tuning_parameter(parameter, parameter.step);
+        }
+        auto now = std::chrono::high_resolution_clock::now();
+        std::cout << "pass " << pass << ": error " << best_error << ", " << improved << " weights changed, "
+                  << std::chrono::duration_cast<std::chrono::seconds>(now - start).count() << " seconds" << std::endl;
+        // keep the header current so an interrupted run is not lost
+        if (!write_parameter_header(header_path)) { stop_tuning_pool(pool); return 1; }
+        if (improved == 0) { break; }
+    }
+    stop_tuning_pool(pool);
+    std::cout << "wrote " << header_path << std::endl;
+    return 0;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////
+// SELF-PLAY MATCHES
+// two sets of evaluation weights (the built in ones or headers written by "tune") play
+// each other from every position of an opening file, once with each color.  Every game
+// is played by its own forked process, one per core, and each side of a game searches
+// in a process of its own with its weights and tables.  The results are reported
+// as an Elo difference with a 95% error bar and a sequential probability ratio test,
+// which stops the match as soon as one of the two Elo hypotheses is accepted.
+/////////////////////////////////////////////////////////////////////////////////////
+struct EvalParameters {
+    int val[6];
+    int mobility;
+    int doubled; int isolated; int backward;
+    int passed[8];
+    int pst[7][64];
+};
+
+void capture_parameters(EvalParameters& parameters) {
+    std::copy(VAL, VAL + 6, parameters.val);
+    parameters.mobility = MOBILITY_INCENTIVE;
+    parameters.doubled = DOUBLED_PENALTY; parameters.isolated = ISOLATED_PENALTY; parameters.backward = BACKWARD_PENALTY;
+    std::copy(PASSED_BONUS, PASSED_BONUS + 8, parameters.passed);
+    std::copy(&PST[0][0], &PST[0][0] + 7*64, &parameters.pst[0][0]);
+}
+
+void install_parameters(const EvalParameters& parameters) {
+    std::copy(parameters.val, parameters.val + 6, VAL);
+    MOBILITY_INCENTIVE = parameters.mobility;
+    DOUBLED_PENALTY = parameters.doubled; ISOLATED_PENALTY = parameters.isolated; BACKWARD_PENALTY = parameters.backward;
+    std::copy(parameters.passed, parameters.passed + 8, PASSED_BONUS);
+    std::copy(&parameters.pst[0][0], &parameters.pst[0][0] + 7*64, &PST[0][0]);
+    // the material table's scaling compares piece values, and cached scores were made with
+    // the other weights
+    init_material_table();
+    clear_hash_table(); clear_eval_cache(); clear_pawn_hash();
+}
+
+bool read_parameter_values(const std::string& text, const std::string& name, int* values, int length) {
+    // find "NAME = 5;" or "NAME[8] = { ... };" and read the numbers up to the semicolon
+    size_t at = 0;
+    while ((at = text.find(name, at)) != std::string::npos) {
+        size_t end = at + name.size();
+        bool whole_word = (((at == 0) || !(isalnum(text[at-1]) || (text[at-1] == '_'))) && !(isalnum(text[end]) || (text[end] == '_')));
+        size_t equals = text.find('=', end);
+        if (whole_word && (equals != std::string::npos) && (text.find_first_not_of(" []0123456789", end) == equals)) {
+            size_t semicolon = text.find(';', equals);
+            const char* p = text.c_str() + equals + 1;
+            const char* stop = text.c_str() + semicolon;
+            int n = 0;
+            while ((p < stop) && (n < length)) {
+                if (isdigit(*p) || ((*p == '-') && isdigit(p[1]))) { values[n++] = (int)strtol(p, (char**)&p, 10); }
+                else { p++; }
+            }
+            return (n == length);
+        }
+        at = end;
+    }
+    return false;
+}
+
+bool load_parameters(const std::string& path, EvalParameters& parameters) {
+    // "default" stands for the weights this program was built with
+    capture_parameters(parameters);
+    if (path == "default") { return true; }
+    std::ifstream file(path);
+    if (!file) { std::cout << "CANNOT OPEN " << path << std::endl; return false; }
+    std::string text((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    const char* names[5] = { "P_VAL", "N_VAL", "B_VAL", "R_VAL", "Q_VAL" };
+    bool complete = true;
+    for (int i=0; i<5; i++) { complete &= read_parameter_values(text, names[i], &parameters.val[i], 1); }
+    complete &= read_parameter_values(text, "MOBILITY_INCENTIVE", &parameters.mobility, 1);
+    complete &= read_parameter_values(text, "DOUBLED_PENALTY", &parameters.doubled, 1);
+    complete &= read_parameter_values(text, "ISOLATED_PENALTY", &parameters.isolated, 1);
+    complete &= read_parameter_values(text, "BACKWARD_PENALTY", &parameters.backward, 1);
+    complete &= read_parameter_values(text, "PASSED_BONUS", parameters.passed, 8);
+    complete &= read_parameter_values(text, "PST", &parameters.pst[0][0], 7*64);
+    if (!complete) { std::cout << path << " IS MISSING SOME WEIGHTS" << std::endl; }
+    return complete;
+}
+
+int count_legal_moves(int color) {
+    int num_moves = generate_color_moves_list(color, 1);
+    int legal = 0;
+    for (int i=0; i<num_moves; i++) {
+        if (move_is_legal(moves_list[0][i], color)) { legal++; }
+    }
+    return legal;
+}
+
+int first_legal_move(int color) {
+    int num_moves = generate_color_moves_list(color, 1);
+    for (int i=0; i<num_moves; i++) {
+        if (move_is_legal(moves_list[0][i], color)) { return moves_list[0][i]; }
+    }
+    return 0;
+}
+
+int set_match_opening(const std::string& opening) {
+    // the board, side, castling and en passant fields of an opening line; returns the side
+    // to move
+    std::istringstream fields(opening);
+    std::string board, side, castling, en_passant;
+    fields >> board >> side >> castling >> en_passant;
+    new_game(); read_FEN(board);
+    int color = ((side == "b") ? black : white);
+    int rights = parse_castling_field(castling);
+    if (rights >= 0) { castling_rights &= rights; }
+    if ((en_passant.size() == 2) && (en_passant[0] >= 'a') && (en_passant[0] <= 'h')) {
+        // the square a pawn skipped, which the other side may capture on
+        uint64_t square = (1ULL << square_index(en_passant[0], en_passant[1]));
+        if (color == white) { en_passant_b = square; } else { en_passant_w = square; }
+    }
+    update_checks();
+    return color;
+}
+
+struct MatchPlayer {
+    pid_t pid;
+    int moves;  // every move played, and 0 when it is this side's turn
+    int replies;// the moves it chose
+};
+
+void match_player(int moves_fd, int replies_fd, const std::string& opening, const EvalParameters& parameters, const SearchLimits& limits) {
+    // one side of a game, in its own process so its weights are installed once and its
+    // tables last the whole game
+    install_parameters(parameters);
+    int color = set_match_opening(opening);
+    int move;
+    while (read(moves_fd, &move, sizeof(move)) == (ssize_t)sizeof(move)) {
+        if (move) { make_move(move); color = opp(color); continue; }
+        move = limited_search(color, limits).move;
+        if (write(replies_fd, &move, sizeof(move)) != (ssize_t)sizeof(move)) { break; }
+    }
+    _exit(0);
+}
+
+bool start_match_player(MatchPlayer& player, const std::string& opening, const EvalParameters& parameters,
+                        const SearchLimits& limits, const MatchPlayer* other) {
+    int to_player[2]; int from_player[2];
+    if ((pipe(to_player) != 0) || (pipe(from_player) != 0)) { return false; }
+    player.pid = fork();
+    if (player.pid == 0) {
+        // the player should not hold the other player's pipes open
+        if (other) { close(other->moves); close(other->replies); }
+        close(to_player[1]); close(from_player[0]);
+        match_player(to_player[0], from_player[1], opening, parameters, limits);
+    }
+    close(to_player[0]); close(from_player[1]);
+    if (player.pid < 0) { return false; }
+    player.moves = to_player[1]; player.replies = from_player[0];
+    return true;
+}
+
+int play_match_moves(const std::string& opening, MatchPlayer players[2]) {
+    // returns white's points in halves: 0, 1 or 2, or 3 if a player stopped answering
+    int color = set_match_opening(opening);
+    std::vector<uint64_t> history;
+
+    for (int ply=0; ply<MATCH_MAX_PLIES; ply++) {
+        update_checks();
+        bool in_check = ((color == white) ? (pos[wK] & checks[1]) : (pos[bK] & checks[0]));
+        if (count_legal_moves(color) == 0) {
+            if (!in_check) { return 1; }
+            return ((color == white) ? 0 : 2);
+        }
+        if (game_is_drawn_by_insufficient_material() || (halfmove_clock >= 100)) { return 1; }
+        uint64_t key = gen_zobrist_key(color);
+        if (std::count(history.begin(), history.end(), key) >= 2) { return 1; }
+        history.push_back(key);
+
+        int move = 0;
+        MatchPlayer& player = players[color - white];
+        if ((write(player.moves, &move, sizeof(move)) != (ssize_t)sizeof(move)) ||
+            (read(player.replies, &move, sizeof(move)) != (ssize_t)sizeof(move))) { return 3; }
+        update_checks();
+        if (!move_is_legal(move, color)) { move = first_legal_move(color); }
+
+        make_move(move);
+        for (int p=0; p<2; p++) {
+            if (write(players[p].moves, &move, sizeof(move)) != (ssize_t)sizeof(move)) { return 3; }
+        }
+        color = opp(color);
+    }
+    return 1;
+}
+
+int play_match_game(const std::string& opening, const EvalParameters* sides[2], const SearchLimits& limits) {
+    // each side searches in a process of its own, so neither has to swap weights or clear
+    // tables between moves.  Returns white's points in halves as play_match_moves does
+    MatchPlayer players[2];
+    if (!start_match_player(players[0], opening, *sides[0], limits, nullptr)) { return 3; }
+    if (!start_match_player(players[1], opening, *sides[1], limits, &players[0])) { return 3; }
+    int points = play_match_moves(opening, players);
+    for (MatchPlayer& player : players) {
+        close(player.moves); close(player.replies);
+        waitpid(player.pid, nullptr, 0);
+    }
+    return points;
+}
+
+double expected_score(double elo) {
+    return (1.0 / (1.0 + pow(10.0, -elo / 400.0)));
+}
+
+double score_elo(double score) {
+    score = std::min(std::max(score, 0.001), 0.999);
+    return (-400.0 * log10(1.0 / score - 1.0));
+}
+
+void report_match(long wins, long draws, long losses, double& llr) {
+    // trinomial approximation of the log likelihood ratio for elo SPRT_ELO1 over SPRT_ELO0
+    long games = (wins + draws + losses);
+    double score = (wins + 0.5 * draws) / std::max(1L, games);
+    double variance = ((wins * pow(1.0 - score, 2) + draws * pow(0.5 - score, 2) + losses * pow(score, 2)) / std::max(1L, games));
+    double margin = 1.96 * sqrt(variance / std::max(1L, games));
+    double s0 = expected_score(SPRT_ELO0); double s1 = expected_score(SPRT_ELO1);
+    llr = ((variance > 0) ? (games * (s1 - s0) * (2*score - s0 - s1) / (2*variance)) : 0);
+
+    printf("games %ld: +%ld =%ld -%ld  score %.1f%%  elo %.1f +- %.1f  llr %.2f (%.2f, %.2f)\n",
+           games, wins, draws, losses, 100*score, score_elo(score),
+           (score_elo(score + margin) - score_elo(score - margin)) / 2,
+           llr, log(SPRT_BETA / (1 - SPRT_ALPHA)), log((1 - SPRT_BETA) / SPRT_ALPHA));
+    fflush(stdout);
+}
+
+bool parse_search_limit(const std::string& text, SearchLimits& limits) {
+    if (text.compare(0, 6, "nodes=") == 0) { limits.nodes = atol(text.c_str() + 6); return true; }
+    if (text.compare(0, 3, "ms=") == 0) { limits.milliseconds = atol(text.c_str() + 3); return true; }
+    if (text.compare(0, 6, "depth=") == 0) { limits.depth = atoi(text.c_str() + 6); return true; }
+    if (text.compare(0, 8, "multipv=") == 0) { limits.multipv = atoi(text.c_str() + 8); return true; }
+    std::cout << "UNKNOWN LIMIT " << text << " (use nodes=N, ms=N, depth=N or multipv=N)" << std::endl;
+    return false;
+}
+
+bool parse_search_limits(const std::vector<std::string>& options, SearchLimits& limits) {
+    // the first node, time or depth limit replaces the default ones, multipv only adds lines
+    bool replaced = false;
+    for (const std::string& option : options) {
+        if (!replaced && (option.compare(0, 8, "multipv=") != 0)) {
+            limits.depth = 0; limits.nodes = 0; limits.milliseconds = 0;
+            replaced = true;
+        }
+        if (!parse_search_limit(option, limits)) { return false; }
+    }
+    return true;
+}
+
+int run_match(int argc, char* argv[]) {
+    // full_version match OPENINGS A B [GAMES] [LIMIT]
+    std::ifstream file(argv[2]);
+    if (!file) { std::cout << "CANNOT OPEN " << argv[2] << std::endl; return 1; }
+    std::vector<std::string> openings;
+    std::string line;
+    while (std::getline(file, line)) {
+        if (!line.empty() && (line[0] != '#')) { openings.push_back(line); }
+    }
+    if (openings.empty()) { std::cout << "NO OPENINGS IN " << argv[2] << std::endl; return 1; }
+
+    EvalParameters first; EvalParameters second;
+    if (!load_parameters(argv[3], first) || !load_parameters(argv[4], second)) { return 1; }
+    long total_games = ((argc >= 6) ? atol(argv[5]) : 2*(long)openings.size());
+    SearchLimits limits = { 0, MATCH_NODES, 0, 1 };
+    if (argc >= 7) {
+        limits.nodes = 0;
+        if (!parse_search_limit(argv[6], limits)) { return 1; }
+    }
+
+    // solved once here, the forked games share the tables
+    init_bitbases();
+    std::cout << argv[3] << " vs " << argv[4] << ", " << total_games << " games from " << openings.size() << " openings" << std::endl;
+    int num_workers = std::max(1u, std::thread::hardware_concurrency());
+    std::unordered_map<pid_t, long> running; // process of each game
+    long wins = 0; long draws = 0; long losses = 0; long started = 0;
+    double llr = 0;
+    bool decided = false;
+
+    while (!running.empty() || (!decided && (started < total_games))) {
+        while (!decided && (started < total_games) && ((int)running.size() < num_workers)) {
+            long game = started++;
+            pid_t pid = fork();
+            if (pid == 0) {
+                // the first weights play white in even games
+                const EvalParameters* sides[2] = { &first, &second };
+                if (game % 2) { std::swap(sides[0], sides[1]); }
+                int result = play_match_game(openings[(game / 2) % openings.size()], sides, limits);
+                _exit(result);
+            }
+            if (pid < 0) { std::cout << "CANNOT START GAME" << std::endl; return 1; }
+            running[pid] = game;
+        }
+
+        int status;
+        pid_t pid = wait(&status);
+        if (pid < 0) { break; }
+        long game = running[pid]; running.erase(pid);
+        if (!WIFEXITED(status) || (WEXITSTATUS(status) > 2)) { std::cout << "GAME " << game << " FAILED" << std::endl; continue; }
+        // convert white's result to the first weights' result
+        int points = WEXITSTATUS(status);
+        if (game % 2) { points = 2 - points; }
+        if (points == 2) { wins++; } else if (points == 1) { draws++; } else { losses++; }
+
+        report_match(wins, draws, losses, llr);
+        if (llr >= log((1 - SPRT_BETA) / SPRT_ALPHA)) { decided = true; }
+        else if (llr <= log(SPRT_BETA / (1 - SPRT_ALPHA))) { decided = true; }
+    }
+
+    if (llr >= log((1 - SPRT_BETA) / SPRT_ALPHA)) { std::cout << "SPRT: H1 accepted, " << argv[3] << " is stronger" << std::endl; }
+    else if (llr <= log(SPRT_BETA / (1 - SPRT_ALPHA))) { std::cout << "SPRT: H0 accepted, no gain over " << argv[4] << std::endl; }
+    else { std::cout << "SPRT: inconclusive" << std::endl; }
+    return 0;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////
+// TEST SUITES
+// tactical suites such as WAC or ECM are EPD files whose positions carry the best move
+// (bm) or a move to avoid (am).  Each position is searched by its own forked process,
+// one per core, and a position counts as solved when the final move is right.  The
+// time and nodes it took to settle on that move are what a faster search improves.
+/////////////////////////////////////////////////////////////////////////////////////
+struct SuitePosition {
+    std::string id;
+    std::string board;
+    int color;
+    uint64_t en_passant_w; uint64_t en_passant_b;
+    int castling_rights;    // from the castling field, -1 when the line has none
+    int halfmove_clock;
+    std::vector<int> best_moves;
+    std::vector<int> avoid_moves;
+};
+
+void set_suite_position(const SuitePosition& position) {
+    read_FEN(position.board);
+    en_passant_w = position.en_passant_w; en_passant_b = position.en_passant_b;
+    // a right needs its king and rook at home as well, whatever the field says
+    if (position.castling_rights >= 0) { castling_rights &= position.castling_rights; }
+    halfmove_clock = position.halfmove_clock;
+    update_checks();
+}
+
+size_t parse_EPD_position(const std::string& line, SuitePosition& position) {
+    // reads the board, side to move, castling and en passant fields, and a FEN's move
+    // counters when they follow, returning where the operations start
+    // (std::string::npos when the position is unusable)
+    std::vector<std::string> fields;
+    size_t at = 0;
+    for (int i=0; (i<4) && (at < line.size()); i++) {
+        size_t end = line.find(' ', at);
+        if (end == std::string::npos) { end = line.size(); }
+        fields.push_back(line.substr(at, end - at));
+        at = end + 1;
+    }
+    if (fields.size() < 2) { return std::string::npos; }
+    position.board = fields[0];
+    position.color = ((fields[1] == "b") ? black : white);
+    position.en_passant_w = 0; position.en_passant_b = 0;
+    position.castling_rights = ((fields.size() >= 3) ? parse_castling_field(fields[2]) : -1);
+    position.halfmove_clock = 0;
+    for (int counter=0; (counter<2) && (fields.size() >= 4) && (at < line.size()) && isdigit(line[at]); counter++) {
+        size_t end = line.find(' ', at);
+        if (end == std::string::npos) { end = line.size(); }
+        if (counter == 0) { position.halfmove_clock = atoi(line.c_str() + at); }
+        at = end + 1;
+    }
+    if ((fields.size() >= 4) && (fields[3].size() == 2) && (fields[3][0] >= 'a') && (fields[3][0] <= 'h')) {
+        // the square a pawn skipped, which the other side may capture on
+        uint64_t square = (1ULL << square_index(fields[3][0], fields[3][1]));
+        if (position.color == white) { position.en_passant_b = square; } else { position.en_passant_w = square; }
+    }
+    set_suite_position(position);
+    if ((count(pos[wK]) != 1) || (count(pos[bK]) != 1)) { return std::string::npos; }
+    return std::min(at, line.size());
+}
+
+bool parse_suite_line(const std::string& line, SuitePosition& position) {
+    size_t at = parse_EPD_position(line, position);
+    if (at == std::string::npos) { return false; }
+
+    // operations are separated by semicolons: bm Qg6 Rxf7; id "WAC.003";
+    std::string operations = ((at < line.size()) ? line.substr(at) : "");
+    size_t start = 0;
+    while (start < operations.size()) {
+        size_t end = operations.find(';', start);
+        if (end == std::string::npos) { end = operations.size(); }
+        std::istringstream operation(operations.substr(start, end - start));
+        std::string opcode; std::string operand;
+        operation >> opcode;
+        while (operation >> operand) {
+            if (opcode == "id") {
+                position.id += ((position.id.empty() ? "" : " ") + operand);
+            }
+            else if ((opcode == "bm") || (opcode == "am")) {
+                int move = parse_SAN(operand, position.color, 1);
+                if (move == 0) { continue; }
+                if (opcode == "bm") { position.best_moves.push_back(move); } else { position.avoid_moves.push_back(move); }
+            }
+        }
+        start = end + 1;
+    }
+    position.id.erase(std::remove(position.id.begin(), position.id.end(), '"'), position.id.end());
+    return (!position.best_moves.empty() || !position.avoid_moves.empty());
+}
+
+bool suite_move_is_correct(const SuitePosition& position, int move) {
+    if (!position.best_moves.empty() && (std::find(position.best_moves.begin(), position.best_moves.end(), move) == position.best_moves.end())) { return false; }
+    return (std::find(position.avoid_moves.begin(), position.avoid_moves.end(), move) == position.avoid_moves.end());
+}
+
+int run_suite(const char* suite_path, const SearchLimits& limits) {
+    std::ifstream file(suite_path);
+    if (!file) { std::cout << "CANNOT OPEN " << suite_path << std::endl; return 1; }
+    std::vector<SuitePosition> positions;
+    std::string line;
+    while (std::getline(file, line)) {
+        SuitePosition position;
+        if (line.empty() || (line[0] == '#')) { continue; }
+        if (!parse_suite_line(line, position)) { std::cout << "SKIPPED: " << line << std::endl; continue; }
+        if (position.id.empty()) { position.id = std::to_string(positions.size() + 1); }
+        positions.push_back(position);
+    }
+    std::cout << positions.size() << " positions from " << suite_path << std::endl;
+    init_bitbases();
+
+    int num_workers = std::max(1u, std::thread::hardware_concurrency());
+    std::unordered_map<pid_t, std::pair<size_t, int>> running; // position and result pipe of each search
+    std::vector<SearchSummary> results(positions.size());
+    int solved = 0; long total_nodes_searched = 0; long solve_milliseconds = 0;
+    size_t started = 0;
+    auto start = std::chrono::steady_clock::now();
+
+    while (!running.empty() || (started < positions.size())) {
+        while ((started < positions.size()) && ((int)running.size() < num_workers)) {
+            size_t index = started++;
+            int channel[2];
+            if (pipe(channel) != 0) { std::cout << "CANNOT START SEARCH" << std::endl; return 1; }
+            pid_t pid = fork();
+            if (pid == 0) {
+                close(channel[0]);
+                set_suite_position(positions[index]);
+                SearchSummary result = limited_search(positions[index].color, limits);
+                ssize_t written = write(channel[1], &result, sizeof(result));
+                _exit((written == (ssize_t)sizeof(result)) ? 0 : 1);
+            }
+            close(channel[1]);
+            if (pid < 0) { std::cout << "CANNOT START SEARCH" << std::endl; return 1; }
+            running[pid] = std::make_pair(index, channel[0]);
+        }
+
+        int status;
+        pid_t pid = wait(&status);
+        if (pid < 0) { break; }
+        size_t index = running[pid].first; int channel = running[pid].second;
+        running.erase(pid);
+        SearchSummary& result = results[index];
+        bool finished = (read(channel, &result, sizeof(result)) == (ssize_t)sizeof(result));
+        close(channel);
+
+        const SuitePosition& position = positions[index];
+        if (!finished) { std::cout << position.id << "  SEARCH FAILED" << std::endl; continue; }
+        set_suite_position(position);
+        bool correct = suite_move_is_correct(position, result.move);
+        total_nodes_searched += result.nodes;
+        if (correct) { solved++; solve_milliseconds += result.found_milliseconds; }
+        printf("%-12s %-7s %-6s", position.id.c_str(), correct ? "solved" : "failed", move_to_string(result.move).c_str());
+        if (correct) { printf(" found in %6.2fs, %9ld nodes, depth %2d", result.found_milliseconds / 1000.0, result.found_nodes, result.found_depth); }
+        else { printf("                                         "); }
+        printf("  | searched %6.2fs, %9ld nodes, depth %2d\n", result.milliseconds / 1000.0, result.nodes, result.depth);
+        fflush(stdout);
+    }
+
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    printf("\nsolved %d of %zu (%.1f%%), %.2fs to solve them, %ld nodes, %.2fs on %d cores\n",
+           solved, positions.size(), 100.0 * solved / std::max<size_t>(1, positions.size()),
+           solve_milliseconds / 1000.0, total_nodes_searched, seconds, num_workers);
+    return 0;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////
+// BATCH ANALYSIS
+// positions are streamed in one FEN per line and answered with one JSON line each, in
+// the order they came in.  A pool of forked workers (one per core) each search one
+// position at a time with their own tables, fed and read through pipes.  Only a
+// window of BATCH_WINDOW positions is ever in flight, so memory stays bounded however
+// long the stream is and however far a slow search holds up the output.
+/////////////////////////////////////////////////////////////////////////////////////
+struct BatchWorker {
+    pid_t pid;
+    FILE* jobs;     // positions to the worker, nullptr once it could not be restarted
+    FILE* results;  // answers from the worker
+    long job;       // position being searched, -1 when idle
+    std::string fen;
+};
+
+std::string json_escape(const std::string& text) {
+    std::string escaped;
+    for (char c : text) {
+        if ((c == '"') || (c == '\\')) { escaped += '\\'; escaped += c; }
+        else if ((unsigned char)c >= ' ') { escaped += c; }
+    }
+    return escaped;
+}
+
+std::string json_moves(const std::vector<int>& moves) {
+    std::string json = "[";
+    for (size_t i=0; i<moves.size(); i++) { json += ((i ? ",\"" : "\"") + move_to_string(moves[i]) + "\""); }
+    return json + "]";
+}
+
+template <typename Search>
+std::string analyze_position(const std::string& fen, const SearchLimits& limits, int& depth, Search search) {
+    std::string json = "{\"fen\":\"" + json_escape(fen) + "\"";
+    SuitePosition position;
+    depth = 0;
+    if (parse_EPD_position(fen, position) == std::string::npos) { return json + ",\"error\":\"invalid position\"}"; }
+    if (count_legal_moves(position.color) == 0) {
+        update_checks();
+        bool in_check = ((position.color == white) ? (pos[wK] & checks[1]) : (pos[bK] & checks[0]));
+        depth = MAX_DEPTH;
+        return json + ",\"bestmove\":null,\"result\":\"" + (in_check ? "checkmate" : "stalemate") + "\"}";
+    }
+
+    SearchResult result = search(position.color);
+    depth = result.depth;
+    // threads sharing the transposition table can leave a stale move at the root
+    if (!move_is_legal(result.move, position.color)) { result.move = first_legal_move(position.color); }
+    json += ",\"bestmove\":\"" + move_to_string(result.move) + "\"";
+    json += ",\"score\":" + std::to_string(result.score);
+    json += ",\"depth\":" + std::to_string(result.depth);
+    json += ",\"nodes\":" + std::to_string(result.nodes);
+    json += ",\"time_ms\":" + std::to_string(result.milliseconds);
+    json += ",\"pv\":" + json_moves(result.lines.empty() ? std::vector<int>() : result.lines[0].pv);
+
+    // multipv answers list every line in the order found, the first repeating the fields above
+    if (limits.multipv > 1) {
+        json += ",\"lines\":[";
+        for (size_t i=0; i<result.lines.size(); i++) {
+            const SearchLine& line = result.lines[i];
+            json += (i ? ",{" : "{");
+            json += "\"move\":\"" + move_to_string(line.move) + "\"";
+            json += ",\"score\":" + std::to_string(line.score);
+            json += ",\"depth\":" + std::to_string(line.depth);
+            json += ",\"pv\":" + json_moves(line.pv) + "}";
+        }
+        json += "]";
+    }
+    return json + "}";
+}
+
+std::string analyze_position(const std::string& fen, const SearchLimits& limits, int& depth) {
+    return analyze_position(fen, limits, depth, [&limits](int color) { return limited_search(color, limits); });
+}
+
+void batch_worker(int jobs_fd, int results_fd, const SearchLimits& limits) {
+    FILE* jobs = fdopen(jobs_fd, "r");
+    FILE* results = fdopen(results_fd, "w");
+    char* line = nullptr; size_t capacity = 0;
+    while (getline(&line, &capacity, jobs) > 0) {
+        std::string fen(line);
+        while (!fen.empty() && ((fen.back() == '\n') || (fen.back() == '\r'))) { fen.pop_back(); }
+        int depth;
+        fprintf(results, "%s\n", analyze_position(fen, limits, depth).c_str());
+        fflush(results);
+    }
+    _exit(0);
+}
+
+bool start_batch_worker(BatchWorker& worker, const SearchLimits& limits, std::vector<BatchWorker>& others) {
+    int to_worker[2]; int from_worker[2];
+    if ((pipe(to_worker) != 0) || (pipe(from_worker) != 0)) { return false; }
+    worker.pid = fork();
+    if (worker.pid == 0) {
+        // the worker should not hold the other workers' pipes open
+        for (BatchWorker& other : others) {
+            if (other.jobs) { fclose(other.jobs); }
+            if (other.results) { fclose(other.results); }
+        }
+        close(to_worker[1]); close(from_worker[0]);
+        batch_worker(to_worker[0], from_worker[1], limits);
+    }
+    close(to_worker[0]); close(from_worker[1]);
+    if (worker.pid < 0) { return false; }
+    worker.jobs = fdopen(to_worker[1], "w");
+    worker.results = fdopen(from_worker[0], "r");
+    worker.job = -1;
+    return true;
+}
+
+int run_batch(const char* input_path, const SearchLimits& limits) {
+    std::ifstream file;
+    if (strcmp(input_path, "-") != 0) {
+        file.open(input_path);
+        if (!file) { std::cerr << "CANNOT OPEN " << input_path << std::endl; return 1; }
+    }
+    std::istream& input = ((strcmp(input_path, "-") == 0) ? std::cin : file);
+    init_bitbases();
+    signal(SIGPIPE, SIG_IGN);
+
+    int num_workers = std::max(1u, std::thread::hardware_concurrency());
+    std::vector<BatchWorker> workers(num_workers, BatchWorker{ 0, nullptr, nullptr, -1, "" });
+    for (BatchWorker& worker : workers) {
+        if (!start_batch_worker(worker, limits, workers)) { std::cerr << "CANNOT START WORKER" << std::endl; return 1; }
+    }
+
+    // answers that arrived ahead of their turn wait here, at most BATCH_WINDOW of them
+    std::vector<std::string> pending(BATCH_WINDOW);
+    std::vector<bool> ready(BATCH_WINDOW, false);
+    long next_job = 0; long next_output = 0; int busy = 0;
+    bool input_done = false;
+    std::string fen;
+    char* line = nullptr; size_t capacity = 0;
+
+    while (!input_done || (busy > 0)) {
+        // hand out positions while there are idle workers and room in the window
+        int alive = 0;
+        for (BatchWorker& worker : workers) {
+            if (worker.jobs == nullptr) { continue; }
+            alive++;
+            if ((worker.job >= 0) || input_done || ((next_job - next_output) >= BATCH_WINDOW)) { continue; }
+            do {
+                if (!std::getline(input, fen)) { input_done = true; break; }
+                while (!fen.empty() && ((fen.back() == '\r') || (fen.back() == ' '))) { fen.pop_back(); }
+            } while (fen.empty());
+            if (input_done) { break; }
+            fprintf(worker.jobs, "%s\n", fen.c_str());
+            fflush(worker.jobs);
+            worker.job = next_job++;
+            worker.fen = fen;
+            busy++;
+        }
+        if (alive == 0) { std::cerr << "NO WORKERS LEFT" << std::endl; break; }
+        if (busy == 0) { continue; }
+
+        // wait for any worker to answer
+        std::vector<pollfd> waiting;
+        std::vector<BatchWorker*> owners;
+        for (BatchWorker& worker : workers) {
+            if (worker.job >= 0) { waiting.push_back({ fileno(worker.results), POLLIN, 0 }); owners.push_back(&worker); }
+        }
+        if (poll(waiting.data(), waiting.size(), -1) < 0) { continue; }
+        for (size_t i=0; i<waiting.size(); i++) {
+            if (!(waiting[i].revents & (POLLIN | POLLHUP))) { continue; }
+            BatchWorker& worker = *owners[i];
+            long job = worker.job;
+            std::string answer;
+            ssize_t length = getline(&line, &capacity, worker.results);
+            if ((length > 0) && (line[length-1] == '\n')) { answer.assign(line, length-1); }
+            else {
+                // the worker died on this position, which is reported rather than tried again
+                // (it may be what killed the worker), and a new worker takes its place
+                answer = "{\"fen\":\"" + json_escape(worker.fen) + "\",\"error\":\"worker failed\"}";
+                fclose(worker.jobs); fclose(worker.results);
+                worker.jobs = nullptr; worker.results = nullptr;
+                kill(worker.pid, SIGKILL);
+                waitpid(worker.pid, nullptr, 0);
+                if (!start_batch_worker(worker, limits, workers)) { std::cerr << "CANNOT RESTART WORKER" << std::endl; worker.jobs = nullptr; }
+            }
+            pending[job % BATCH_WINDOW] = answer;
+            ready[job % BATCH_WINDOW] = true;
+            worker.job = -1;
+            busy--;
+        }
+
+        // write out everything that is now in order
+        while (ready[next_output % BATCH_WINDOW]) {
+            ready[next_output % BATCH_WINDOW] = false;
+            std::cout << pending[next_output % BATCH_WINDOW] << '\n';
+            pending[next_output % BATCH_WINDOW].clear();
+            next_output++;
+        }
+        std::cout.flush();
+    }
+
+    for (BatchWorker& worker : workers) { if (worker.jobs) { fclose(worker.jobs); } }
+    for (BatchWorker& worker : workers) { if (worker.results) { waitpid(worker.pid, nullptr, 0); fclose(worker.results); } }
+    free(line);
+    return (input_done && (busy == 0)) ? 0 : 1;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////
+// ANALYSIS DAEMON
+// a long running server that answers the same requests as batch mode over a Unix
+// domain socket (or a localhost TCP port), so the tables are set up once and the
+// transposition table stays warm from one request to the next.  Every connection
+// sends one position per line and gets one JSON line back; its jobs are queued to a
+// pool of search threads.  Finished answers are remembered by position key and depth,
+// so asking again for the same position, e.g. replaying a game, is only a lookup.
+/////////////////////////////////////////////////////////////////////////////////////
+struct DaemonJob {
+    std::string fen;
+    SearchLimits limits;
+    std::promise<std::string> answer;
+};
+
+struct DaemonQueue {
+    std::vector<DaemonJob*> jobs;
+    std::mutex lock;
+    std::condition_variable not_empty;
+};
+
+struct CachedAnalysis {
+    int depth;
+    int multipv;
+    std::string json;
+};
+
+std::unordered_map<uint64_t, CachedAnalysis> DAEMON_CACHE;
+std::mutex daemon_cache_lock;
+std::atomic<long> daemon_requests(0); std::atomic<long> daemon_cache_hits(0);
+// held shared by every search, so a snapshot is only loaded into an idle table
+std::shared_mutex daemon_table_lock;
+
+std::string daemon_analysis(const std::string& fen, const SearchLimits& limits) {
+    // a depth limited request is answered by any earlier search at least as deep
+    SuitePosition position;
+    if (parse_EPD_position(fen, position) == std::string::npos) {
+        return "{\"fen\":\"" + json_escape(fen) + "\",\"error\":\"invalid position\"}";
+    }
+    uint64_t key = gen_zobrist_key(position.color);
+    daemon_requests++;
+    if (limits.depth > 0) {
+        std::lock_guard<std::mutex> guard(daemon_cache_lock);
+        auto cached = DAEMON_CACHE.find(key);
+        if ((cached != DAEMON_CACHE.end()) && (cached->second.depth >= limits.depth) && (cached->second.multipv == limits.multipv)) {
+            daemon_cache_hits++;
+            return ("{\"fen\":\"" + json_escape(fen) + "\"" + cached->second.json);
+        }
+    }
+
+    // the answer is cached without its fen, which is written as each request spelled it
+    int depth;
+    std::string json = analyze_position(fen, limits, depth);
+    size_t fen_field = ("{\"fen\":\"" + json_escape(fen) + "\"").size();
+    std::lock_guard<std::mutex> guard(daemon_cache_lock);
+    if ((int)DAEMON_CACHE.size() >= DAEMON_CACHE_LIMIT) { DAEMON_CACHE.clear(); }
+    CachedAnalysis& entry = DAEMON_CACHE[key];
+    if ((depth >= entry.depth) || (entry.multipv != limits.multipv)) {
+        entry.depth = depth; entry.multipv = limits.multipv; entry.json = json.substr(fen_field);
+    }
+    return json;
+}
+
+void daemon_worker(DaemonQueue& queue) {
+    while (true) {
+        DaemonJob* job;
+        {
+            std::unique_lock<std::mutex> guard(queue.lock);
+            queue.not_empty.wait(guard, [&queue]() { return !queue.jobs.empty(); });
+            job = queue.jobs.front();
+            queue.jobs.erase(queue.jobs.begin());
+        }
+        std::shared_lock<std::shared_mutex> searching(daemon_table_lock);
+        job->answer.set_value(daemon_analysis(job->fen, job->limits));
+    }
+}
+
+bool send_line(int connection, const std::string& text) {
+    std::string line = text + "\n";
+    size_t sent = 0;
+    while (sent < line.size()) {
+        ssize_t n = send(connection, line.data() + sent, line.size() - sent, MSG_NOSIGNAL);
+        if (n <= 0) { return false; }
+        sent += n;
+    }
+    return true;
+}
+
+bool snapshot_name_allowed(const std::string& path) {
+    // a bare file name, so a client cannot reach outside the working directory
+    return (!path.empty() && (path != ".") && (path != "..") && (path.find('/') == std::string::npos)
+            && (path.find('\0') == std::string::npos));
+}
+
+void daemon_connection(int connection, DaemonQueue& queue) {
+    // requests look like "FEN [depth=N|nodes=N|ms=N] [multipv=N]", or "stats", "save [FILE]",
+    // "load [FILE]" and "quit"
+    std::string buffer; char chunk[4096];
+    bool open = true;
+    while (open) {
+        ssize_t n = recv(connection, chunk, sizeof(chunk), 0);
+        if (n <= 0) { break; }
+        buffer.append(chunk, n);
+        size_t end;
+        while (open && ((end = buffer.find('\n')) != std::string::npos)) {
+            std::string request = buffer.substr(0, end);
+            buffer.erase(0, end + 1);
+            while (!request.empty() && ((request.back() == '\r') || (request.back() == ' '))) { request.pop_back(); }
+            if (request.empty()) { continue; }
+            if (request == "quit") { open = false; break; }
+            if (request == "stats") {
+                std::lock_guard<std::mutex> guard(daemon_cache_lock);
+                open = send_line(connection, "{\"requests\":" + std::to_string(daemon_requests.load()) + ",\"cache_hits\":"
+                                 + std::to_string(daemon_cache_hits.load()) + ",\"cached_positions\":" + std::to_string(DAEMON_CACHE.size()) + "}");
+                continue;
+            }
+            std::string command = request.substr(0, request.find(' '));
+            if ((command == "save") || (command == "load")) {
+                // a snapshot taken mid search holds whatever the searches have stored so far,
+                // but loading one under a running search is refused.  Any client may ask, so
+                // only a plain file name in the daemon's working directory is accepted
+                std::string path = (request.size() > 5) ? request.substr(5) : HASH_SNAPSHOT_FILE;
+                bool done = false; bool busy = false;
+                if (!snapshot_name_allowed(path)) {
+                    open = send_line(connection, "{\"" + command + "\":\"" + json_escape(path) + "\",\"ok\":false,\"error\":\"not a file name\"}");
+                    continue;
+                }
+                if (command == "save") { done = save_hash_table(path); }
+                else {
+                    std::unique_lock<std::shared_mutex> idle(daemon_table_lock, std::try_to_lock);
+                    busy = !idle.owns_lock();
+                    if (!busy) { done = load_hash_table(path); }
+                }
+                open = send_line(connection, "{\"" + command + "\":\"" + json_escape(path) + "\",\"ok\":" + (done ? "true" : "false")
+                                 + (busy ? ",\"error\":\"searching\"" : "") + "}");
+                continue;
+            }
+
+            DaemonJob job;
+            job.limits = { BATCH_DEPTH, 0, 0, 1 };
+            std::vector<std::string> options;
+            size_t option;
+            while (((option = request.find_last_of(' ')) != std::string::npos) && (request.find('=', option) != std::string::npos)) {
+                options.insert(options.begin(), request.substr(option + 1));
+                request.erase(option);
+            }
+            if (!parse_search_limits(options, job.limits)) { job.limits = { BATCH_DEPTH, 0, 0, 1 }; }
+            job.fen = request;
+            std::future<std::string> answer = job.answer.get_future();
+            {
+                std::lock_guard<std::mutex> guard(queue.lock);
+                queue.jobs.push_back(&job);
+            }
+            queue.not_empty.notify_one();
+            open = send_line(connection, answer.get());
+        }
+    }
+    close(connection);
+}
+
+int open_daemon_socket(const std::string& address) {
+    // a port number listens on localhost, anything else is a Unix socket path
+    int server;
+    if (!address.empty() && (address.find_first_not_of("0123456789") == std::string::npos)) {
+        server = socket(AF_INET, SOCK_STREAM, 0);
+        int reuse = 1;
+        setsockopt(server, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+        sockaddr_in local = {};
+        local.sin_family = AF_INET;
+        local.sin_port = htons(atoi(address.c_str()));
+        local.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        if ((server < 0) || (bind(server, (sockaddr*)&local, sizeof(local)) != 0)) { return -1; }
+    }
+    else {
+        server = socket(AF_UNIX, SOCK_STREAM, 0);
+        sockaddr_un local = {};
+        local.sun_family = AF_UNIX;
+        if (address.size() >= sizeof(local.sun_path)) { return -1; }
+        strcpy(local.sun_path, address.c_str());
+        unlink(address.c_str());
+        if ((server < 0) || (bind(server, (sockaddr*)&local, sizeof(local)) != 0)) { return -1; }
+    }
+    if (listen(server, 64) != 0) { return -1; }
+    return server;
+}
+
+int run_daemon(const std::string& address, const char* snapshot) {
+    int server = open_daemon_socket(address);
+    if (server < 0) { std::cout << "CANNOT LISTEN ON " << address << std::endl; return 1; }
+    init_bitbases();
+    if (snapshot && load_hash_table(snapshot)) { std::cout << "hash table loaded from " << snapshot << std::endl; }
+
+    DaemonQueue queue;
+    int num_threads = std::max(1u, std::thread::hardware_concurrency());
+    for (int t=0; t<num_threads; t++) { std::thread(daemon_worker, std::ref(queue)).detach(); }
+    std::cout << "listening on " << address << " with " << num_threads << " search threads" << std::endl;
+
+    while (true) {
+        int connection = accept(server, nullptr, nullptr);
+        if (connection < 0) { continue; }
+        std::thread(daemon_connection, connection, std::ref(queue)).detach();
+    }
+    return 0;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////
+// DISTRIBUTED SEARCH
+// one analysis spread over several engine processes.  A coordinator runs iterative
+// deepening and hands the root moves out to worker processes as work units, young
+// brothers wait style: the first move of the ordering is searched alone, and once it
+// has set the window the rest are searched in parallel.  Workers connect to the
+// coordinator's socket, so besides the ones it forks more can be started by hand, and
+// send back the deep entries they stored, which are passed on to the other workers
+// with their next units.  Units are raw structs, every process must be the same build.
+/////////////////////////////////////////////////////////////////////////////////////
+struct WorkUnit {
+    int32_t move;       // root move to search below, 0 tells the worker to stop
+    int32_t depth;      // iteration depth, the unit searches one ply less below the move
+    int32_t reduction;  // the late move reduction minimax would give the move
+    int32_t alpha;
+    int32_t beta;
+    int32_t fen_length; // the root position follows the unit
+    int32_t entries;    // then the shared hash entries
+    int64_t nodes;      // the search's remaining node budget, 0 for no limit
+};
+
+struct WorkResult {
+    int32_t move;
+    int32_t score;
+    int64_t nodes;
+    int32_t pv_length;  // moves of the variation below the root move
+    int32_t entries;    // deep hash entries sent after the result
+    int32_t aborted;    // the node budget ran out, the score means nothing
+    Move pv[MAX_DEPTH];
+};
+
+bool send_all(int connection, const void* data, size_t bytes) {
+    const char* next = (const char*)data;
+    while (bytes > 0) {
+        ssize_t n = send(connection, next, bytes, MSG_NOSIGNAL);
+        if (n <= 0) { return false; }
+        next += n; bytes -= n;
+    }
+    return true;
+}
+
+bool receive_all(int connection, void* data, size_t bytes) {
+    char* next = (char*)data;
+    while (bytes > 0) {
+        ssize_t n = recv(connection, next, bytes, 0);
+        if (n <= 0) { return false; }
+        next += n; bytes -= n;
+    }
+    return true;
+}
+
+int connect_socket(const std::string& address) {
+    // the addresses of open_daemon_socket, a localhost port number or a Unix socket path
+    int connection;
+    if (!address.empty() && (address.find_first_not_of("0123456789") == std::string::npos)) {
+        connection = socket(AF_INET, SOCK_STREAM, 0);
+        sockaddr_in remote = {};
+        remote.sin_family = AF_INET;
+        remote.sin_port = htons(atoi(address.c_str()));
+        remote.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        if ((connection < 0) || (connect(connection, (sockaddr*)&remote, sizeof(remote)) != 0)) { return -1; }
+    }
+    else {
+        connection = socket(AF_UNIX, SOCK_STREAM, 0);
+        sockaddr_un remote = {};
+        remote.sun_family = AF_UNIX;
+        if (address.size() >= sizeof(remote.sun_path)) { return -1; }
+        strcpy(remote.sun_path, address.c_str());
+        if ((connection < 0) || (connect(connection, (sockaddr*)&remote, sizeof(remote)) != 0)) { return -1; }
+    }
+    return connection;
+}
+
+WorkResult search_work_unit(const WorkUnit& unit, const std::string& fen) {
+    // the part of the root's move loop in minimax below one move
+    WorkResult result = {};
+    result.move = unit.move;
+    SuitePosition position;
+    if (parse_EPD_position(fen, position) == std::string::npos) { return result; }
+    iteration_depth = unit.depth;
+    search_stats = SearchStats();
+    iteration_node_limit = unit.nodes;
+    search_aborted = false;
+    make_move(unit.move);
+    update_checks();
+    result.score = -minimax(opp(position.color), unit.depth-1, unit.reduction, -unit.beta, -unit.alpha);
+    takeback_move(unit.move);
+    result.aborted = search_aborted;
+    iteration_node_limit = 0; search_aborted = false;
+    result.nodes = 1 + search_stats.minimax_nodes + search_stats.quiescence_nodes; // the root move counts as a node too
+    for (int n=1; n<pv_length[1]; n++) { result.pv[result.pv_length++] = pv_table[1][n]; }
+    return result;
+}
+
+void split_worker(int connection) {
+    // search units until the coordinator says stop or goes away
+    share_depth = SPLIT_SHARE_DEPTH;
+    WorkUnit unit;
+    while (receive_all(connection, &unit, sizeof(unit)) && (unit.move != 0)) {
+        std::string fen(std::max(unit.fen_length, 0), ' ');
+        std::vector<HashEntry> entries(std::max(unit.entries, 0));
+        if (!receive_all(connection, &fen[0], fen.size()) || !receive_all(connection, entries.data(), sizeof(HashEntry) * entries.size())) { break; }
+        for (const HashEntry& entry : entries) { store_shared_entry(entry); }
+
+        shared_entries.clear();
+        WorkResult result = search_work_unit(unit, fen);
+        result.entries = shared_entries.size();
+        if (!send_all(connection, &result, sizeof(result))) { break; }
+        if (!send_all(connection, shared_entries.data(), sizeof(HashEntry) * shared_entries.size())) { break; }
+    }
+    close(connection);
+}
+
+int run_worker(const std::string& address) {
+    int connection = connect_socket(address);
+    if (connection < 0) { std::cout << "CANNOT CONNECT TO " << address << std::endl; return 1; }
+    init_bitbases();
+    split_worker(connection);
+    return 0;
+}
+
+struct SplitWorker {
+    int connection;     // -1 once the worker has gone away
+    int job;            // index of the root move being searched, -1 when idle
+    size_t shared_sent; // entries of the shared log the worker has been sent
+};
+
+struct SharedEntry {
+    HashEntry entry;
+    int connection;     // the worker it came from, which needs no copy
+};
+
+struct SplitCoordinator {
+    int server;
+    std::vector<SplitWorker> workers;
+    std::vector<SharedEntry> shared; // every shared entry of the current position
+};
+
+bool send_work_unit(SplitCoordinator& coordinator, SplitWorker& worker, WorkUnit unit, const std::string& fen) {
+    std::vector<HashEntry> entries;
+    for (size_t i=worker.shared_sent; i<coordinator.shared.size(); i++) {
+        if (coordinator.shared[i].connection != worker.connection) { entries.push_back(coordinator.shared[i].entry); }
+    }
+    worker.shared_sent = coordinator.shared.size();
+    unit.fen_length = fen.size();
+    unit.entries = entries.size();
+    return send_all(worker.connection, &unit, sizeof(unit)) && send_all(worker.connection, fen.data(), fen.size())
+        && send_all(worker.connection, entries.data(), sizeof(HashEntry) * entries.size());
+}
+
+bool receive_work_result(SplitCoordinator& coordinator, SplitWorker& worker, WorkResult& result) {
+    if (!receive_all(worker.connection, &result, sizeof(result))) { return false; }
+    if ((result.entries < 0) || (result.pv_length < 0) || (result.pv_length > MAX_DEPTH)) { return false; }
+    std::vector<HashEntry> entries(result.entries);
+    if (!receive_all(worker.connection, entries.data(), sizeof(HashEntry) * entries.size())) { return false; }
+    for (const HashEntry& entry : entries) { coordinator.shared.push_back({ entry, worker.connection }); }
+    return true;
+}
+
+bool search_root_moves(SplitCoordinator& coordinator, const std::string& fen, std::vector<SearchLine>& root, int depth, long& nodes, long budget) {
+    // one iteration.  Moves are handed out from the front of the ordering, and until the
+    // first one has come back it is the only one out.  A worker that goes away puts its
+    // move back at the front for the next idle worker.  With a node budget (0 for none)
+    // every unit may use what is left of it, no unit is handed out once it is spent, and
+    // the iteration is abandoned as soon as a unit runs out
+    int alpha = -2000000; int beta = 2000000;
+    int num_moves = root.size();
+    std::vector<int> waiting;
+    for (int i=num_moves-1; i>=0; i--) { waiting.push_back(i); }
+    bool eldest_done = false; int busy = 0;
+    long before = nodes; bool aborted = false;
+
+    while (!waiting.empty() || (busy > 0)) {
+        for (SplitWorker& worker : coordinator.workers) {
+            if ((worker.job >= 0) || waiting.empty() || (!eldest_done && (busy > 0))) { continue; }
+            int i = waiting.back();
+            WorkUnit unit = { root[i].move, depth, 0, alpha, beta, 0, 0, ((budget > 0) ? (budget - (nodes - before)) : 0) };
+            if ((depth >= 3) && (i > 1)) {
+                if (i > (num_moves * 0.70)) { unit.reduction = 2; }
+                else if (i > (num_moves * 0.30)) { unit.reduction = 1; }
+            }
+            if (!send_work_unit(coordinator, worker, unit, fen)) { close(worker.connection); worker.connection = -1; worker.job = -1; continue; }
+            waiting.pop_back();
+            worker.job = i;
+            busy++;
+        }
+        coordinator.workers.erase(std::remove_if(coordinator.workers.begin(), coordinator.workers.end(),
+                                  [](const SplitWorker& worker) { return worker.connection < 0; }), coordinator.workers.end());
+
+        // wait for an answer, or for a new worker (the only way on with none left)
+        std::vector<pollfd> ready = { { coordinator.server, POLLIN, 0 } };
+        std::vector<int> owners;
+        for (size_t w=0; w<coordinator.workers.size(); w++) {
+            if (coordinator.workers[w].job >= 0) { ready.push_back({ coordinator.workers[w].connection, POLLIN, 0 }); owners.push_back(w); }
+        }
+        if (poll(ready.data(), ready.size(), -1) < 0) { continue; }
+        for (size_t r=1; r<ready.size(); r++) {
+            if (!(ready[r].revents & (POLLIN | POLLHUP | POLLERR))) { continue; }
+            SplitWorker& worker = coordinator.workers[owners[r-1]];
+            int i = worker.job;
+            worker.job = -1; busy--;
+            WorkResult result;
+            if (!receive_work_result(coordinator, worker, result) || (result.move != root[i].move)) {
+                close(worker.connection); worker.connection = -1;
+                if (!aborted) { waiting.push_back(i); }
+                continue;
+            }
+            nodes += result.nodes;
+            if (result.aborted) { aborted = true; continue; }
+            root[i].score = result.score; root[i].depth = depth;
+            root[i].pv.assign(1, result.move);
+            root[i].pv.insert(root[i].pv.end(), result.pv, result.pv + result.pv_length);
+            alpha = std::max(alpha, result.score);
+            if (i == 0) { eldest_done = true; }
+        }
+        if (ready[0].revents & POLLIN) {
+            int connection = accept(coordinator.server, nullptr, nullptr);
+            if (connection >= 0) { coordinator.workers.push_back({ connection, -1, 0 }); }
+        }
+        if ((budget > 0) && ((nodes - before) >= budget)) { aborted = true; }
+        if (aborted) { waiting.clear(); }
+    }
+    return !aborted;
+}
+
+SearchResult distributed_search(SplitCoordinator& coordinator, const std::string& fen, int color, const SearchLimits& limits) {
+    // limited_search over the workers, only the best line is reported
+    SearchResult result = { { 0, 0, 0, 0, 0, 0, 0, 0 }, {} };
+    std::vector<SearchLine> root;
+    int num_moves = generate_color_moves_list(color, 1);
+    for (int i=0; i<num_moves; i++) {
+        if (move_is_legal(moves_list[0][i], color)) { root.push_back({ moves_list[0][i], -2000000, 0, {} }); }
+    }
+    // the shared log only lives as long as one position
+    coordinator.shared.clear();
+    for (SplitWorker& worker : coordinator.workers) { worker.shared_sent = 0; }
+
+    int depth_cap = ((limits.depth > 0) ? std::min(limits.depth, MAX_DEPTH-1) : MAX_DEPTH-1);
+    auto start = std::chrono::steady_clock::now();
+    for (int depth=1; depth<=depth_cap; depth++) {
+        // the best move so far goes first, to be the eldest brother
+        std::stable_sort(root.begin(), root.end(), [](const SearchLine& a, const SearchLine& b) { return a.score > b.score; });
+        // like limited_search, the node limit stops any iteration after the first part way,
+        // and an unfinished iteration is dropped but the nodes it used still count
+        long budget = (((limits.nodes > 0) && (depth > 1)) ? (limits.nodes - result.nodes) : 0);
+        if (!search_root_moves(coordinator, fen, root, depth, result.nodes, budget)) {
+            result.milliseconds = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+            break;
+        }
+        const SearchLine& best = *std::max_element(root.begin(), root.end(), [](const SearchLine& a, const SearchLine& b) { return a.score < b.score; });
+
+        result.milliseconds = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+        if ((best.move != result.move) || (result.found_depth == 0)) {
+            result.found_depth = depth; result.found_nodes = result.nodes;
+            result.found_milliseconds = result.milliseconds;
+        }
+        result.move = best.move; result.score = best.score; result.depth = depth;
+        result.lines = { best };
+
+        if ((limits.nodes > 0) && (result.nodes >= limits.nodes)) { break; }
+        if ((limits.milliseconds > 0) && (result.milliseconds >= limits.milliseconds)) { break; }
+    }
+    return result;
+}
+
+int run_distributed(int num_workers, const char* input_path, const SearchLimits& limits) {
+    std::ifstream file;
+    if (strcmp(input_path, "-") != 0) {
+        file.open(input_path);
+        if (!file) { std::cerr << "CANNOT OPEN " << input_path << std::endl; return 1; }
+    }
+    std::istream& input = ((strcmp(input_path, "-") == 0) ? std::cin : file);
+    SplitCoordinator coordinator = { open_daemon_socket(SPLIT_SOCKET), {}, {} };
+    if (coordinator.server < 0) { std::cerr << "CANNOT LISTEN ON " << SPLIT_SOCKET << std::endl; return 1; }
+    init_bitbases();
+    signal(SIGPIPE, SIG_IGN);
+
+    // local workers run the same loop as "full_version worker", in a fork
+    std::vector<pid_t> children;
+    for (int w=0; w<num_workers; w++) {
+        pid_t pid = fork();
+        if (pid == 0) {
+            close(coordinator.server);
+            int connection = connect_socket(SPLIT_SOCKET);
+            if (connection >= 0) { split_worker(connection); }
+            _exit(0);
+        }
+        if (pid > 0) { children.push_back(pid); }
+    }
+    std::cerr << "coordinating on " << SPLIT_SOCKET << " with " << children.size() << " local workers" << std::endl;
+
+    std::string fen;
+    while (std::getline(input, fen)) {
+        while (!fen.empty() && ((fen.back() == '\r') || (fen.back() == ' '))) { fen.pop_back(); }
+        if (fen.empty()) { continue; }
+        int depth;
+        std::cout << analyze_position(fen, limits, depth, [&](int color) { return distributed_search(coordinator, fen, color, limits); }) << std::endl;
+    }
+
+    // stop every worker, the ones started by hand too
+    WorkUnit stop = {};
+    for (SplitWorker& worker : coordinator.workers) { send_all(worker.connection, &stop, sizeof(stop)); close(worker.connection); }
+    for (pid_t pid : children) { waitpid(pid, nullptr, 0); }
+    close(coordinator.server);
+    if (std::string(SPLIT_SOCKET).find_first_not_of("0123456789") != std::string::npos) { unlink(SPLIT_SOCKET); }
+    return 0;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////
+// BENCHMARK
+// a fixed search of fixed positions.  The total node count is a signature of the
+// search: a change that should only make the engine faster has to keep it, and one
+// that changes the search on purpose changes it.  The speed is reported alongside
+/////////////////////////////////////////////////////////////////////////////////////
+const char* BENCH_POSITIONS[] = {
+    // openings
+    "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1",
+    "r1bqkb1r/pppp1ppp/2n2n2/4p3/2B1P3/5N2/PPPP1PPP/RNBQK2R w KQkq - 4 4",
+    "rnbqkb1r/1p2pppp/p2p1n2/8/3NP3/2N5/PPP2PPP/R1BQKB1R w KQkq - 0 6",
+    "rnbqkb1r/ppp2ppp/4pn2/3p4/2PP4/2N5/PP2PPPP/R1BQKBNR w KQkq - 2 4",
+    "rnbqk2r/pppp1ppp/4pn2/8/1bPP4/2N5/PP2PPPP/R1BQKBNR w KQkq - 2 4",
+    "rnbqkbnr/pp2pppp/2p5/3pP3/3P4/8/PPP2PPP/RNBQKBNR b KQkq - 0 3",
+    "r1bq1rk1/2p1bppp/p1np1n2/1p2p3/4P3/1BP2N1P/PP1P1PP1/RNBQR1K1 b - - 0 9",
+    "r1bq1rk1/ppp1npbp/3p2p1/3Pp2n/1PP1P3/2N2N2/P3BPPP/R1BQ1RK1 w - - 1 10",
+    "r1bqk2r/pp2bppp/2n1pn2/2pp4/3P4/2PBPN2/PP1N1PPP/R1BQK2R w KQkq - 0 7",
+    // middlegames
+    "r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - 0 1",
+    "r3k2r/Pppp1ppp/1b3nbN/nP6/BBP1P3/q4N2/Pp1P2PP/R2Q1RK1 w kq - 0 1",
+    "rnbq1k1r/pp1Pbppp/2p5/8/2B5/8/PPP1NnPP/RNBQK2R w KQ - 1 8",
+    "r4rk1/1pp1qppp/p1np1n2/2b1p1B1/2B1P1b1/P1NP1N2/1PP1QPPP/R4RK1 w - - 0 10",
+    "r1b2rk1/2q1b1pp/p2ppn2/1p6/3QP3/1BN1B3/PPP3PP/R4RK1 w - - 0 1",
+    "4rrk1/pp1n3p/3q2pQ/2p1pb2/2PP4/2P3N1/P2B2PP/4RRK1 b - - 7 19",
+    "r2q1rk1/pp2ppbp/2p2np1/6B1/3PP1b1/Q1P2N2/P4PPP/3RKB1R b K - 0 13",
+    "2rr3k/pp3pp1/1nnqbN1p/3pN3/2pP4/2P3Q1/PPB4P/R4RK1 w - - 0 1",
+    "5rk1/1ppb3p/p1pb4/6q1/3P1p1r/2P1R2P/PP1BQ1P1/5RKN w - - 0 1",
+    "r1bq2rk/pp3pbp/2p1p1pQ/7P/3P4/2PB1N2/PP3PPR/2KR4 w - - 0 1",
+    "5k2/6pp/p1qN4/1p1p4/3P4/2PKP2Q/PP3r2/3R4 b - - 0 1",
+    "rnbqkb1r/pppp1ppp/8/4P3/6n1/7P/PPPNPPP1/R1BQKBNR b KQkq - 0 1",
+    "r4q1k/p2bR1rp/2p2Q1N/5p2/5p2/2P5/PP3PPP/R5K1 w - - 0 1",
+    "3q1rk1/p4pp1/2pb3p/3p4/6Pr/1PNQ4/P1PB1PP1/4RRK1 b - - 0 1",
+    "2br2k1/2q3rn/p2NppQ1/2p1P3/Pp5R/4P3/1P3PPP/3R2K1 w - - 0 1",
+    "r1b1kb1r/3q1ppp/pBp1pn2/8/Np3P2/5B2/PPP3PP/R2QK2R w KQkq - 0 1",
+    "4k1r1/2p3r1/1pR1p3/3pP2p/3P2qP/P4N2/1PQ4P/5R1K b - - 0 1",
+    "5rk1/pp4p1/2n1p2p/2Npq3/2p5/6P1/P3P1BP/R4Q1K w - - 0 1",
+    "r2rb1k1/pp1q1p1p/2n1p1p1/2bp4/5P2/PP1BPR1Q/1BPN2PP/R5K1 w - - 0 1",
+    // endgames
+    "8/2p5/3p4/KP5r/1R3p1k/8/4P1P1/8 w - - 0 1",
+    "7k/p7/1R5K/6r1/6p1/6P1/8/8 w - - 0 1",
+    "8/k7/3p4/p2P1p2/P2P1P2/8/8/K7 w - - 0 1",
+    "1K1k4/1P6/8/8/8/8/r7/2R5 w - - 0 1",
+    "4k3/8/r7/4PK2/8/8/8/7R b - - 0 1",
+    "8/8/8/3k4/8/8/1r6/K4Q2 w - - 0 1",
+    "8/5k2/3n4/4p3/4P3/3N4/5K2/8 w - - 0 1",
+    "8/4kp2/4b1p1/8/2B5/6P1/5PK1/8 w - - 0 1",
+    "6k1/5pp1/7p/8/8/6P1/q4PKP/3Q4 w - - 0 1",
+    "8/pp3k2/2p5/5r2/8/1P4R1/P4PPK/8 w - - 0 1",
+    "8/3k4/1p1p2p1/p1pP1pP1/P1P2P2/1P2K3/8/8 w - - 0 1",
+    "8/P7/8/8/8/8/k6p/7K w - - 0 1",
+};
+
+void clear_search_tables() {
+    // everything one search leaves behind for the next
+    clear_hash_table(); clear_eval_cache(); clear_pawn_hash();
+    memset(principal_variation, 0, sizeof(principal_variation));
+    memset(current_variation, 0, sizeof(current_variation));
+    memset(pv_table, 0, sizeof(pv_table));
+    memset(pv_length, 0, sizeof(pv_length));
+    memset(layer_best_moves, 0, sizeof(layer_best_moves));
+    memset(layer_previous_evals, 0, sizeof(layer_previous_evals));
+    memset(layer_killer_moves, 0, sizeof(layer_killer_moves));
+}
+
+int run_bench(int depth) {
+    // one thread, and every table cleared before each position, so the count does not
+    // depend on the order either.  Bitbases are left out, bitbases.bin would change it
+    // (the killer and variation tables are indexed one past the depth, so stop a ply short)
+    depth = std::min(std::max(depth, 1), MAX_DEPTH-1);
+    int num_positions = sizeof(BENCH_POSITIONS) / sizeof(BENCH_POSITIONS[0]);
+    // only the searches are timed, clearing a large hash table would swamp them
+    long nodes = 0;
+    double seconds = 0;
+    for (const char* fen : BENCH_POSITIONS) {
+        SuitePosition position;
+        parse_EPD_position(fen, position);
+        clear_search_tables();
+        update_checks();
+        total_nodes = 0;
+        auto start = std::chrono::steady_clock::now();
+        depth_search(position.color, depth, 0, false);
+        seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        nodes += total_nodes;
+    }
+    printf("%ld nodes, %.2fs, %.0f nps (%d positions to depth %d, %s evaluation, %d MB hash)\n",
+           nodes, seconds, nodes / std::max(seconds, 0.001), num_positions, depth, nnue_loaded ? "nnue" : "classical",
+           (int)(((sizeof(HashSlot) * hash_table_length) + (1 << 19)) >> 20));
+    return 0;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////
+// PLAYER INTERFACE
+/////////////////////////////////////////////////////////////////////////////////////
+void print_title() {
+    std::cout << "KITTY BOX COMMAND LINE CHESS ENGINE\n" << std::endl;
+}
+
+void set_position() {
+    char choice;
+    std::cout << "PLAY A STANDARD GAME?" << std::endl;
+    std::cout << "[Y]:yes [N]:enter FEN\nENTER: ";
+
+    std::cin >> choice;
+    choice = toupper(choice);
+
+    if (choice == 'Y') {
+        new_game();
+    }
+    else {
+        std::string fen;
+        std::cout << "\nENTER FEN: ";
+        std::cin >> fen;
+        read_FEN(fen);
+    }
+}
+
+void assign_colors(){
+    char color;
+    std::cout << "\nSELECT COLOR TO BEGIN:\n[W]:white [B]:black [R]:random\nENTER: ";
+    std::cin >> color;
+    color = toupper(color);
+
+    if (color == 'W') {
+        player = white;
+        computer = black;
+    }
+    else if (color == 'B') {
+        player = black;
+        computer = white;
+    }
+    else if (color == 'R') {
+        int selector = (rand() % 2);
+        player = (13 + selector);
+        computer = (14 - selector);
+    }
+    else {
+        std::cout << "INVALID OPTION" << std::endl;
+        return assign_colors();
     }
 }
 
@@ -1396,6 +5281,8 @@ void print_help_menu() {
     std::cout << "  characters, selecting a square without a piece on it, " << std::endl;
     std::cout << "  selecting an enemy piece, or making an illegal move." << std::endl;
     std::cout << "\n  Ex: enter \"E2:E4\" to move a piece from e2 to e4." << std::endl;
+    std::cout << "  Pawns promote to a queen unless N, B or R is added," << std::endl;
+    std::cout << "  e.g. \"E7:E8N\" promotes to a knight." << std::endl;
 
     std::cout << "\nTAKING BACK MOVES:" << std::endl;
     std::cout << "* Enter \"BACK\" to undo one move (white and black)." << std::endl;
@@ -1431,7 +5318,8 @@ void print_help_menu() {
 
 bool input_is_formatted(std::string move) {
     // improper formatting conditions
-    if (move.length() != 5) { return false; }
+    if ((move.length() != 5) && (move.length() != 6)) { return false; }
+    else if ((move.length() == 6) && (promotion_letter(move[5]) == 0)) { return false; }
     else if (move[2] != ':') { return false; }
     else if ((move[0] < 'A') || (move[0] > 'H')) { return false; }
     else if ((move[1] < '1') || (move[1] > '8')) { return false; }
@@ -1461,8 +5349,8 @@ int get_player_move(int color, int move_number) {
         if (move_number >= 2) {
             int opp_last_move = game_continuation[move_number-1];
             int own_last_move = game_continuation[move_number-2];
-            takeback_move((opp_last_move >> 6), (opp_last_move & 63), (MAX_DEPTH + move_number - 1));
-            takeback_move((own_last_move >> 6), (own_last_move & 63), (MAX_DEPTH + move_number - 2));
+            takeback_move(opp_last_move);
+            takeback_move(own_last_move);
             print_board();
             return get_player_move(color, move_number-1);
         }
@@ -1479,7 +5367,7 @@ int get_player_move(int color, int move_number) {
     }
 
     else if (move == "HINT") {
-        int move = depth_search(color, 5);
+        int move = depth_search(color, 5, MAX_SEARCH_TIME, true);
         print_coords(move); std::cout << std::endl;
         clear_hash_table();
         return get_player_move(color, move_number);
@@ -1489,17 +5377,19 @@ int get_player_move(int color, int move_number) {
         origination = 63-((move[0] - 'A') + ('8' - move[1])*8);
         destination = 63-((move[3] - 'A') + ('8' - move[4])*8);
 
+        int promotion = ((move.length() == 6) ? promotion_letter(move[5]) : 0);
+
         // if the destination square matches one of the possible moves and isn't
         // occupied by the piece's own color, then the move is legal
         if (pos[color] & (1ULL << origination)) {
-            if (((~pos[color]) & generate_piece_moves(origination)) & (1ULL << destination)) {
-                make_move(origination, destination, 2*MAX_DEPTH+move_number+1);
+            int player_move = find_move(color, origination, destination, promotion, 1);
+            if (player_move) {
+                make_move(player_move);
                 update_checks();
-                takeback_move(origination, destination, 2*MAX_DEPTH+move_number+1);
+                takeback_move(player_move);
                 if (((color == white) && ((pos[wK] & checks[1]) == 0)) ||
                     ((color == black) && ((pos[bK] & checks[0]) == 0))) {
-                    // pack player move
-                    return ((origination << 6) | (destination));
+                    return player_move;
                 }
                 else {
                     std::cout << "KING IS IN CHECK" << std::endl;
@@ -1543,21 +5433,32 @@ bool play_again() {
 /////////////////////////////////////////////////////////////////////////////////////
 // GAMEPLAY
 /////////////////////////////////////////////////////////////////////////////////////
+int get_engine_move(int color) {
+    // play from the opening book while the position is still in it
+    int move = probe_book(color);
+    if (move) {
+        print_coords(move);
+        std::cout << "  book move\n" << std::endl;
+        return move;
+    }
+    return depth_search(color, MAX_DEPTH, MAX_SEARCH_TIME, true);
+}
+
 int get_white_move(int move_number) {
     if (player == white) { return get_player_move(white, move_number); }
-    else { return depth_search(white, MAX_DEPTH); }
+    else { return get_engine_move(white); }
 }
 
 int get_black_move(int move_number) {
     if (player == black) { return get_player_move(black, move_number); }
-    else { return depth_search(black, MAX_DEPTH); }
+    else { return get_engine_move(black); }
 }
 
-int main() {
-    srand(time(0)); 
+void play_game() {
     // std::system("cls"); // for Windows systems
     print_title(); set_position(); assign_colors();
-    fill_RAYS(); update_checks(); seed_tables();
+    update_checks();
+    if (book_data == nullptr) { open_book(BOOK_FILE); }
 
     int move_number = 0; int move;
 
@@ -1572,12 +5473,102 @@ int main() {
         else { move = get_black_move(move_number); }
         if (w_resignation) { break; }
         game_continuation[move_number] = move;
-        make_move((move >> 6), (move & 63), (2*MAX_DEPTH + move_number));
+        make_move(move);
         move_number++;
     }
 
     conclude_game();
-    if (play_again()) { main(); }
+}
+
+/////////////////////////////////////////////////////////////////////////////////////
+// COMMAND LINE TOOLS
+// running the program with arguments starts one of the tools below instead of a game
+/////////////////////////////////////////////////////////////////////////////////////
+void print_usage() {
+    std::cout << "USAGE:" << std::endl;
+    std::cout << "  full_version                          play a game" << std::endl;
+    std::cout << "  full_version book GAMES.pgn [BOOK]    build a polyglot book (default book.bin)" << std::endl;
+    std::cout << "  full_version bitbases                 solve all endgame bitbases into bitbases.bin" << std::endl;
+    std::cout << "  full_version tune POSITIONS [HEADER]  fit the evaluation to labelled positions (default tuned_parameters.h)" << std::endl;
+    std::cout << "  full_version match OPENINGS A B [GAMES] [nodes=N|ms=N|depth=N]" << std::endl;
+    std::cout << "                                        play weights A against B (headers from tune, or default)" << std::endl;
+    std::cout << "  full_version suite TESTS.epd [nodes=N|ms=N|depth=N]" << std::endl;
+    std::cout << "                                        search every bm/am test position (default 5 seconds each)" << std::endl;
+    std::cout << "  full_version batch [FENS|-] [nodes=N|ms=N|depth=N] [multipv=N]" << std::endl;
+    std::cout << "                                        analyze one FEN per line into JSON lines (default stdin, depth 6)" << std::endl;
+    std::cout << "  full_version serve [SOCKET|PORT] [HASH]" << std::endl;
+    std::cout << "                                        answer batch style requests as a daemon (default kitty.sock)," << std::endl;
+    std::cout << "                                        starting from a hash table saved with a \"save\" request" << std::endl;
+    std::cout << "  full_version bench [DEPTH]            search the benchmark positions, printing the node count and speed" << std::endl;
+    std::cout << "  full_version distribute WORKERS [FENS|-] [nodes=N|ms=N|depth=N]" << std::endl;
+    std::cout << "                                        batch analysis with each search split over worker processes" << std::endl;
+    std::cout << "  full_version worker [SOCKET|PORT]     join a distributed search (default kitty-split.sock)" << std::endl;
+    std::cout << "  hash=MB anywhere in the arguments sizes the transposition table (default 16 MB)" << std::endl;
+}
+
+int take_hash_option(int argc, char* argv[]) {
+    // hash=MB applies to every command, so it is taken out before they see their arguments
+    int kept = 1;
+    for (int i=1; i<argc; i++) {
+        if (strncmp(argv[i], "hash=", 5) != 0) { argv[kept++] = argv[i]; continue; }
+        if (!resize_hash_table(atoi(argv[i] + 5))) {
+            std::cout << "CANNOT ALLOCATE " << argv[i] << " (use 1 to " << MAX_HASH_MB << " MB)" << std::endl;
+            return -1;
+        }
+    }
+    argv[kept] = nullptr;
+    return kept;
+}
+
+int run_command(int argc, char* argv[]) {
+    std::string command = argv[1];
+    if ((command == "book") && (argc >= 3)) {
+        return build_book(argv[2], (argc >= 4) ? argv[3] : BOOK_FILE);
+    }
+    else if (command == "bitbases") { return write_bitbases(); }
+    else if ((command == "tune") && (argc >= 3)) {
+        return tune_evaluation(argv[2], (argc >= 4) ? argv[3] : "tuned_parameters.h");
+    }
+    else if ((command == "match") && (argc >= 5)) { return run_match(argc, argv); }
+    else if ((command == "suite") && (argc >= 3)) {
+        SearchLimits limits = { 0, 0, 1000L*MAX_SEARCH_TIME, 1 };
+        if (argc >= 4) {
+            limits.milliseconds = 0;
+            if (!parse_search_limit(argv[3], limits)) { return 1; }
+        }
+        return run_suite(argv[2], limits);
+    }
+    else if (command == "batch") {
+        SearchLimits limits = { BATCH_DEPTH, 0, 0, 1 };
+        if (!parse_search_limits(std::vector<std::string>(argv + std::min(argc, 3), argv + argc), limits)) { return 1; }
+        return run_batch((argc >= 3) ? argv[2] : "-", limits);
+    }
+    else if ((command == "distribute") && (argc >= 3)) {
+        SearchLimits limits = { BATCH_DEPTH, 0, 0, 1 };
+        if (!parse_search_limits(std::vector<std::string>(argv + std::min(argc, 4), argv + argc), limits)) { return 1; }
+        // the moves after the first are searched against its window, so only it has an exact score
+        if (limits.multipv > 1) { std::cerr << "DISTRIBUTED SEARCH REPORTS ONLY THE BEST LINE (NO multipv=N)" << std::endl; return 1; }
+        return run_distributed(atoi(argv[2]), (argc >= 4) ? argv[3] : "-", limits);
+    }
+    else if (command == "bench") { return run_bench((argc >= 3) ? atoi(argv[2]) : BENCH_DEPTH); }
+    else if (command == "worker") { return run_worker((argc >= 3) ? argv[2] : SPLIT_SOCKET); }
+    else if (command == "serve") {
+        return run_daemon((argc >= 3) ? argv[2] : DAEMON_SOCKET, (argc >= 4) ? argv[3] : nullptr);
+    }
+    print_usage();
+    return 1;
+}
+
+int main(int argc, char* argv[]) {
+    srand(time(0));
+    argc = take_hash_option(argc, argv);
+    if (argc < 0) { return 1; }
+    init_material_table();
+    load_nnue(NNUE_FILE);
+
+    if (argc > 1) { return run_command(argc, argv); }
+    init_bitbases();
 
+    do { play_game(); } while (play_again());
     return 0;
 }